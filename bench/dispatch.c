@@ -0,0 +1,75 @@
+/*
+ * A micro-benchmark of what it costs the VM to dispatch an instruction. It
+ * times a loop, and the same loop with a run of cheap instructions added to
+ * its body, and reports the difference per added instruction. The dispatch
+ * mode is picked when the VM is compiled (see vm.h), so `python3 build.py
+ * bench` builds this once for each mode and runs both.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/builtins.h"
+#include "../src/compiler.h"
+#include "../src/parser.h"
+#include "../src/resolver.h"
+#include "../src/utils.h"
+#include "../src/vm.h"
+
+#define ITERATIONS 2000000
+#define PADDING 64
+#define RUNS 5
+
+/**
+ * @brief a program looping ITERATIONS times, whose body stores the counter in
+ * a local padding times first.
+ */
+static sds loop_program(int padding) {
+    sds program = sdsnew("(let loop (fn (i) ");
+    for (int i = 0; i < padding; i++) {
+        program = sdscat(program, "(let x i); ");
+    }
+    return sdscatprintf(program,
+                        "(if (== i 0) 0 (loop (- i 1))))); (loop %d)",
+                        ITERATIONS);
+}
+
+/**
+ * @brief the best time of RUNS runs of program, in seconds. size is set to
+ * the number of instructions in the body of the loop.
+ */
+static double time_program(sds program, int* size) {
+    char* curr = program;
+    Expression* expr = parse_expr(&curr);
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    Code* code = compile(expr, resolve(expr, &env));
+    *size = cvector_size(code->functions[0]->instructions);
+    double best = 0;
+    for (int run = 0; run < RUNS; run++) {
+        VM vm = new_vm(&env);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        vm_run(&vm, code);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free_vm(&vm);
+        double seconds =
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (run == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+int main() {
+    int base_size, padded_size;
+    double base = time_program(loop_program(0), &base_size);
+    double padded = time_program(loop_program(PADDING), &padded_size);
+    // the padding is straight line code, run once per iteration
+    double instructions = (double)(padded_size - base_size) * ITERATIONS;
+    printf("%s dispatch: %.2f ns per instruction (%.3fs for %d iterations, "
+           "%.3fs with %d more instructions each)\n",
+           VM_DISPATCH, (padded - base) * 1e9 / instructions, base,
+           ITERATIONS, padded, padded_size - base_size);
+}
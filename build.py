@@ -23,6 +23,11 @@ TEST = 'tst'
 SPORK_COMPILER = 'compiler_spork'
 SPORK_TESTSUITE = 'testsuite_spork'
 
+BENCH = 'bench'
+BENCH_FLAGS = '-O2'
+# each dispatch mode of the VM, and the flags that build it
+DISPATCH_MODES = {'threaded': '', 'switch': '-DSPORK_SWITCH_DISPATCH'}
+
 
 # Iterate over every file and folder in the provided directory.
 # If it's a file (e.g. example.c), create a build recipe in the makefile
@@ -109,6 +114,33 @@ def add_linker_target(makefile, target, target_deps, target_obj_deps, exec, run_
     makefile.write(makefile_build)
 
 
+# every c file (except main) in dir and the directories in it
+def find_c_files(dir: str):
+    c_files = []
+    for root, _, fnames in os.walk(dir):
+        for fname in fnames:
+            if fname.endswith(C_FILE_EXT) and fname != MAIN:
+                c_files.append(os.path.join(root, fname))
+    return sorted(c_files)
+
+
+# add a target that builds the dispatch micro-benchmark, optimized, once for
+# each dispatch mode of the VM, and runs them one after the other
+def add_bench_target(makefile: TextIOWrapper):
+    sources = ' '.join(find_c_files(LIBRARIES) + find_c_files(SOURCE))
+    bench_file = os.path.join(BENCH, 'dispatch' + C_FILE_EXT)
+    commands = []
+    for mode, flags in DISPATCH_MODES.items():
+        exec = 'dispatch_' + mode
+        commands.append(' '.join(
+            x for x in [COMPILER, BENCH_FLAGS, flags, bench_file, sources,
+                        '-o', exec, '-rdynamic'] if x))
+        commands.append('./' + exec)
+    # bench is also the name of a directory, which make would take it for
+    makefile.write('.PHONY: {0}\n{0}:\n\t{1}\n\n'.format(
+        BENCH, '\n\t'.join(commands)))
+
+
 # generate the makefile which actually builds our code
 # do incremental builds for the lib and src dirs
 with open('makefile', 'w+') as makefile:
@@ -122,7 +154,9 @@ with open('makefile', 'w+') as makefile:
     add_linker_target(makefile, 'all', 'test', ' '.join(
         [main, lib, src]), SPORK_COMPILER, False)
 
-    clean_target = 'clean:\n\trm *.o {} {}\n\n'.format(
+    add_bench_target(makefile)
+
+    clean_target = 'clean:\n\trm -f *.o {} {} dispatch_*\n\n'.format(
         SPORK_COMPILER,
         SPORK_TESTSUITE
     )
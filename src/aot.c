@@ -0,0 +1,635 @@
+#include "aot.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolver.h"
+#include "symbol.h"
+#include "utils.h"
+
+// a compiled program runs with a fixed VM stack, since the generated code
+// keeps pointers into it, and on a C stack big enough for as many nested calls
+// as that stack has room for
+#define AOT_STACK_SIZE (1 << 21)
+#define AOT_C_STACK_BYTES (512l * 1024 * 1024)
+
+/**
+ * @brief what emit_c needs to know about the program it is writing out. Every
+ * Code gets the index it has in codes, and its object constants are kept in
+ * the generated K array starting at constant_base[index].
+ */
+typedef struct Emitter {
+    FILE* out;
+    cvector_vector_type(Code*) codes;
+    cvector_vector_type(int) constant_base;
+    int constants;
+} Emitter;
+
+static void collect_codes(Emitter* e, Code* code) {
+    cvector_push_back(e->codes, code);
+    cvector_push_back(e->constant_base, e->constants);
+    e->constants += cvector_size(code->constants);
+    for (int i = 0; i < cvector_size(code->functions); i++) {
+        collect_codes(e, code->functions[i]);
+    }
+}
+
+static int code_index(Emitter* e, Code* code) {
+    for (int i = 0; i < cvector_size(e->codes); i++) {
+        if (e->codes[i] == code) {
+            return i;
+        }
+    }
+    abort();
+}
+
+static bool uses_globals(Code* code) {
+    for (int i = 0; i < cvector_size(code->instructions); i++) {
+        switch (code->instructions[i].op) {
+            case LoadGlobalOp:
+            case StoreGlobalOp:
+            case AddOp:
+            case SubOp:
+            case MulOp:
+            case DivOp:
+            case EqOp:
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static bool calls_itself(Code* code, int index) {
+    // the program isn't a function, so it can't be called, and a memoized fn
+    // needs its args to stay as they were until it returns
+    if (index == 0 || code->memo) {
+        return false;
+    }
+    for (int i = 0; i < cvector_size(code->instructions); i++) {
+        Instruction instruction = code->instructions[i];
+        if (instruction.op == TailCallOp &&
+            instruction.arg == cvector_size(code->params)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void emit_string(FILE* out, sds chars) {
+    fputc('"', out);
+    for (size_t i = 0; i < sdslen(chars); i++) {
+        unsigned char c = chars[i];
+        if (isalnum(c) || c == ' ' || c == '_') {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputc('"', out);
+}
+
+static void emit_constant_init(Emitter* e, Val val, int k) {
+    if (!is_obj(val)) {
+        return;
+    }
+    fprintf(e->out, "    K[%d] = ", k);
+    switch (as_obj(val)->kind) {
+        case StringObj:
+            fprintf(e->out, "string_val(sdsnewlen(");
+            emit_string(e->out, as_string(val));
+            fprintf(e->out, ", %zu));\n", sdslen(as_string(val)));
+            break;
+        case IntObj:
+            fprintf(e->out, "int_val((long)0x%lxul);\n",
+                    (unsigned long)as_int(val));
+            break;
+        default:
+            fprintf(stderr, "can't compile a constant of this kind to C\n");
+            abort();
+    }
+    fprintf(e->out, "    gc_pin(K[%d]);\n", k);
+}
+
+/**
+ * @brief write the code for AddIntOp and friends, whose args are ints: small
+ * ones are handled inline, and the rest by integer_add and friends.
+ */
+static void emit_int_op(FILE* out, Instruction instruction, int a, int b) {
+    static const char* integers[] = {
+        [AddIntOp] = "integer_add", [SubIntOp] = "integer_sub",
+        [MulIntOp] = "integer_mul", [DivIntOp] = "integer_div",
+        [EqIntOp] = "integer_eq",
+    };
+    static const char* results[] = {
+        [AddIntOp] = "int_val(x + y)", [SubIntOp] = "int_val(x - y)",
+        [MulIntOp] = "int_mul(x, y)", [DivIntOp] = "int_val(x / y)",
+        [EqIntOp] = "bool_val(x == y)",
+    };
+    char valid[64] = "";
+    if (instruction.op == DivIntOp) {
+        snprintf(valid, sizeof(valid), " && as_small_int(L[%d]) != 0", b);
+    }
+    fprintf(out,
+            "    if (is_small_int(L[%d]) && is_small_int(L[%d])%s) {\n"
+            "        long x = as_small_int(L[%d]);\n"
+            "        long y = as_small_int(L[%d]);\n"
+            "        L[%d] = %s;\n"
+            "    } else {\n"
+            "        L[%d] = %s(L[%d], L[%d]);\n"
+            "    }\n",
+            a, b, valid, a, b, a, results[instruction.op], a,
+            integers[instruction.op], a, b);
+}
+
+static void emit_binary_op(FILE* out, Instruction instruction, int a, int b) {
+    static const char* builtins[] = {
+        [AddOp] = "builtin_add", [SubOp] = "builtin_sub",
+        [MulOp] = "builtin_mul", [DivOp] = "builtin_div",
+        [EqOp] = "builtin_eq",
+    };
+    static const char* results[] = {
+        [AddOp] = "int_val(x + y)", [SubOp] = "int_val(x - y)",
+        [MulOp] = "int_mul(x, y)", [DivOp] = "int_val(x / y)",
+        [EqOp] = "bool_val(x == y)",
+    };
+    // dividing by zero is left to the builtin, like in the VM
+    char valid[64] = "";
+    if (instruction.op == DivOp) {
+        snprintf(valid, sizeof(valid), " && as_small_int(L[%d]) != 0", b);
+    }
+    fprintf(out,
+            "    if (G[%d].boundValue == builtin_val(%s) && "
+            "is_small_int(L[%d]) && is_small_int(L[%d])%s) {\n"
+            "        long x = as_small_int(L[%d]);\n"
+            "        long y = as_small_int(L[%d]);\n"
+            "        L[%d] = %s;\n"
+            "    } else {\n"
+            "        L[%d] = aot_binary_call(vm, G[%d].boundValue, &L[%d]);\n"
+            "    }\n",
+            instruction.arg, builtins[instruction.op], a, b,
+            valid, a, b, a, results[instruction.op], a, instruction.arg, a);
+}
+
+/**
+ * @brief write code out as the C function fn_<index>. Each value the bytecode
+ * would keep on the VM's stack goes in the slot of the frame it would have
+ * been in, which is known at compile time: the stack is always equally deep
+ * at any given instruction.
+ */
+static void emit_function(Emitter* e, Code* code, int index) {
+    FILE* out = e->out;
+    int count = cvector_size(code->instructions);
+    int* depths = malloc(sizeof(int) * count);
+    bool* targets = calloc(count, sizeof(bool));
+    for (int i = 0; i < count; i++) {
+        depths[i] = -1;
+    }
+    int depth = 0;
+    for (int i = 0; i < count; i++) {
+        Instruction instruction = code->instructions[i];
+        if (depths[i] == -1) {
+            depths[i] = depth;
+        }
+        depth = depths[i] + stack_effect(instruction.op, instruction.arg);
+        if (instruction.op == JumpOp || instruction.op == JumpIfFalseOp) {
+            depths[instruction.arg] = depth;
+            targets[instruction.arg] = true;
+        }
+    }
+
+    int argc = cvector_size(code->params);
+    bool loops = calls_itself(code, index);
+    fprintf(out, "static Val fn_%d(VM* vm, Val* L, Fn* fn) {\n", index);
+    if (uses_globals(code)) {
+        fprintf(out, "    LexicalBinding* G = *vm->globals;\n");
+    }
+    if (loops) {
+        fprintf(out, "start:\n");
+    }
+    for (int i = 0; i < count; i++) {
+        Instruction instruction = code->instructions[i];
+        int arg = instruction.arg;
+        // the slot the next value pushed goes in
+        int top = code->frame.size + depths[i];
+        if (targets[i]) {
+            fprintf(out, "I%d:;\n", i);
+        }
+        switch (instruction.op) {
+            case ConstOp: {
+                Val val = code->constants[arg];
+                if (is_obj(val)) {
+                    fprintf(out, "    L[%d] = K[%d];\n", top,
+                            e->constant_base[index] + arg);
+                } else {
+                    fprintf(out, "    L[%d] = 0x%016lxul;\n", top,
+                            (unsigned long)val);
+                }
+                break;
+            }
+            case LoadGlobalOp:
+                fprintf(out, "    L[%d] = G[%d].boundValue;\n", top, arg);
+                break;
+            case StoreGlobalOp:
+                fprintf(out, "    G[%d].boundValue = L[%d];\n", arg, top - 1);
+                break;
+            case LoadLocalOp:
+                fprintf(out, "    L[%d] = L[%d];\n", top, arg);
+                break;
+            case StoreLocalOp:
+                fprintf(out, "    L[%d] = L[%d];\n", arg, top - 1);
+                break;
+            case LoadCaptureOp:
+                fprintf(out, "    L[%d] = fn->captures[%d];\n", top, arg);
+                break;
+            case FnOp: {
+                Code* fn_code = code->functions[arg];
+                int size = cvector_size(fn_code->frame.captures);
+                fprintf(out, "    L[%d] = new_fn(&C[%d], %d);\n", top,
+                        code_index(e, fn_code), size);
+                for (int j = 0; j < size; j++) {
+                    Address capture = fn_code->frame.captures[j];
+                    fprintf(out, "    as_fn(L[%d])->captures[%d] = ", top, j);
+                    if (capture.kind == LocalAddress) {
+                        fprintf(out, "L[%d];\n", capture.slot);
+                    } else {
+                        fprintf(out, "fn->captures[%d];\n", capture.slot);
+                    }
+                }
+                if (fn_code->frame.self != -1) {
+                    fprintf(out, "    as_fn(L[%d])->captures[%d] = L[%d];\n",
+                            top, fn_code->frame.self, top);
+                }
+                if (fn_code->memo) {
+                    fprintf(out, "    as_fn(L[%d])->memo = new_memo();\n", top);
+                }
+                break;
+            }
+            case CallOp:
+            case ScratchTupleOp:
+                // compiled C makes its tuples on the heap
+                fprintf(out, "    L[%d] = aot_call(vm, &L[%d], %d);\n",
+                        top - arg - 1, top - arg - 1, arg);
+                break;
+            case ParOp:
+                fprintf(out, "    L[%d] = aot_par(vm, &L[%d], %d);\n",
+                        top - arg, top - arg, arg);
+                break;
+            case SpawnOp:
+                fprintf(out, "    L[%d] = aot_spawn(vm, &L[%d]);\n", top - 1,
+                        top - 1);
+                break;
+            case TailCallOp: {
+                int callee = top - arg - 1;
+                if (loops && arg == argc) {
+                    fprintf(out,
+                            "    if (L[%d] == obj_val(&fn->obj)) {\n"
+                            "        if (gc_pending) {\n"
+                            "            gc_safepoint();\n"
+                            "        }\n",
+                            callee);
+                    for (int j = 0; j < argc; j++) {
+                        fprintf(out, "        L[%d] = L[%d];\n", j,
+                                callee + 1 + j);
+                    }
+                    for (int j = argc; j < code->frame.size; j++) {
+                        fprintf(out, "        L[%d] = VOID_VAL;\n", j);
+                    }
+                    fprintf(out, "        goto start;\n    }\n");
+                }
+                fprintf(out, "    return aot_call(vm, &L[%d], %d);\n", callee,
+                        arg);
+                break;
+            }
+            case AddOp:
+            case SubOp:
+            case MulOp:
+            case DivOp:
+            case EqOp:
+                emit_binary_op(out, instruction, top - 2, top - 1);
+                break;
+            case AddIntOp:
+            case SubIntOp:
+            case MulIntOp:
+            case DivIntOp:
+            case EqIntOp:
+                emit_int_op(out, instruction, top - 2, top - 1);
+                break;
+            case JumpOp:
+                fprintf(out, "    goto I%d;\n", arg);
+                break;
+            case JumpIfFalseOp:
+                fprintf(out, "    if (!aot_condition(L[%d])) goto I%d;\n",
+                        top - 1, arg);
+                break;
+            case PopOp:
+                break;
+            case VoidOp:
+                fprintf(out, "    L[%d] = VOID_VAL;\n", top);
+                break;
+            case ReturnOp:
+                fprintf(out, "    return L[%d];\n", top - 1);
+                break;
+        }
+    }
+    fprintf(out, "}\n\n");
+    free(depths);
+    free(targets);
+}
+
+static void emit_strings(FILE* out, cvector_vector_type(Symbol) symbols,
+                         int from) {
+    if (cvector_size(symbols) <= from) {
+        fprintf(out, "NULL");
+        return;
+    }
+    fprintf(out, "(char*[]){");
+    for (int i = from; i < cvector_size(symbols); i++) {
+        emit_string(out, symbols[i]->name);
+        fprintf(out, i + 1 < cvector_size(symbols) ? ", " : "}");
+    }
+}
+
+/**
+ * @brief write program out as a C program that runs it. Every function in it
+ * becomes a C function, and the calls between them are C calls. globals has
+ * to be the environment the program was resolved in, starting with the
+ * builtins.
+ *
+ * @param program
+ * @param globals
+ * @param out
+ */
+void emit_c(Code* program, cvector_vector_type(LexicalBinding) globals,
+            FILE* out) {
+    Emitter e = {.out = out, .codes = NULL, .constant_base = NULL};
+    collect_codes(&e, program);
+    int count = cvector_size(e.codes);
+
+    fprintf(out, "#include \"aot.h\"\n\n");
+    bool objects = false;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < cvector_size(e.codes[i]->constants); j++) {
+            objects |= is_obj(e.codes[i]->constants[j]);
+        }
+    }
+    if (objects) {
+        fprintf(out, "static Val K[%d];\n", e.constants);
+    }
+    fprintf(out, "static Code C[%d];\n\n", count);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "static Val fn_%d(VM* vm, Val* L, Fn* fn);\n", i);
+    }
+    fprintf(out, "\n");
+    for (int i = 0; i < count; i++) {
+        emit_function(&e, e.codes[i], i);
+    }
+
+    fprintf(out, "int main() {\n");
+    for (int i = 0; i < count; i++) {
+        Code* code = e.codes[i];
+        for (int j = 0; j < cvector_size(code->constants); j++) {
+            emit_constant_init(&e, code->constants[j], e.constant_base[i] + j);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        Code* code = e.codes[i];
+        fprintf(out, "    aot_code(&C[%d], fn_%d, %d, ", i, i,
+                (int)cvector_size(code->params));
+        emit_strings(out, code->params, 0);
+        fprintf(out, ", %d, %d);\n", code->frame.size, code->max_stack);
+    }
+
+    cvector_vector_type(LexicalBinding) builtins = NULL;
+    add_builtins(&builtins);
+    int first_global = cvector_size(builtins);
+    cvector_free(builtins);
+    cvector_vector_type(Symbol) names = NULL;
+    for (int i = 0; i < cvector_size(globals); i++) {
+        cvector_push_back(names, globals[i].symbol);
+    }
+    fprintf(out, "    return aot_main(&C[0], ");
+    emit_strings(out, names, first_global);
+    fprintf(out, ", %d);\n}\n",
+            (int)cvector_size(names) - first_global > 0
+                ? (int)cvector_size(names) - first_global
+                : 0);
+    cvector_free(names);
+    cvector_free(e.codes);
+    cvector_free(e.constant_base);
+}
+
+/**
+ * @brief set up code as the Code of a function compiled to C, so it can be
+ * called like any other.
+ */
+void aot_code(Code* code, AotFn fn, int argc, char** params, int size,
+              int max_stack) {
+    *code = (Code){.instructions = NULL,
+                   .constants = NULL,
+                   .functions = NULL,
+                   .params = NULL,
+                   .body = NULL,
+                   .frame = {.size = size, .captures = NULL, .self = -1},
+                   .max_stack = max_stack,
+                   .stack_depth = 0,
+                   .calls = 0,
+                   .native = NULL,
+                   .aot = fn,
+                   .memo = false};
+    for (int i = 0; i < argc; i++) {
+        cvector_push_back(code->params, intern(params[i]));
+    }
+}
+
+/**
+ * @brief run code on the stack starting at locals, whose first argc slots
+ * hold its args. The stack never shrinks below where it was, so every slot
+ * the collector may look at holds a value that is still allocated.
+ */
+static Val run_code(VM* vm, Code* code, Val* locals, int argc, Fn* fn) {
+    Val* sp = vm->sp;
+    Val* top = locals + code->frame.size + code->max_stack;
+    if (top > vm->stack_end) {
+        runtime_error("stack overflow");
+    }
+    for (Val* slot = locals + argc; slot < top; slot++) {
+        *slot = VOID_VAL;
+    }
+    if (top > vm->sp) {
+        vm->sp = top;
+    }
+    Val result = code->aot(vm, locals, fn);
+    vm->sp = sp;
+    return result;
+}
+
+/**
+ * @brief call the value at callee with the argc values above it. Like calls in
+ * the VM, this is a safepoint.
+ */
+Val aot_call(VM* vm, Val* callee, int argc) {
+    if (gc_pending) {
+        gc_safepoint();
+    }
+    Val fn = *callee;
+    if (is_builtin(fn)) {
+        return as_builtin(fn)(vm, callee + 1, argc);
+    } else if (!is_fn(fn)) {
+        runtime_error("trying to call a value that isn't a function");
+    }
+    Code* code = as_fn(fn)->code;
+    if (argc != cvector_size(code->params)) {
+        runtime_error("wrong number of arguments to function");
+    }
+    Memo* memo = as_fn(fn)->memo;
+    Val result;
+    if (memo != NULL && memo_get(memo, callee + 1, argc, &result)) {
+        return result;
+    }
+    result = run_code(vm, code, callee + 1, argc, as_fn(fn));
+    if (memo != NULL) {
+        memo_set(memo, callee + 1, argc, result);
+    }
+    return result;
+}
+
+/**
+ * @brief call callee on the two values at args, when the fast path of a
+ * binary op doesn't apply. There is a free slot above them (the compiler
+ * reserves one for this), so they move up to make room for callee.
+ */
+Val aot_binary_call(VM* vm, Val callee, Val* args) {
+    args[2] = args[1];
+    args[1] = args[0];
+    args[0] = callee;
+    return aot_call(vm, args, 2);
+}
+
+/**
+ * @brief call the count fns at fns, which take no args, and make a tuple of
+ * their results. Compiled C runs them one after the other. There is a free
+ * slot above them (the compiler reserves one for par), so the tuple can be
+ * kept on the stack while they run.
+ */
+Val aot_par(VM* vm, Val* fns, int count) {
+    Val tuple = new_tuple(count);
+    Tuple* results = as_tuple(tuple);
+    // until a fn's result replaces it, the tuple is what keeps it alive
+    memcpy(results->values, fns, sizeof(Val) * count);
+    fns[0] = tuple;
+    for (int i = 0; i < count; i++) {
+        fns[1] = results->values[i];
+        results->values[i] = aot_call(vm, &fns[1], 0);
+    }
+    return tuple;
+}
+
+/**
+ * @brief spawn the fn at fn, which takes no args. Compiled C only runs on the
+ * thread it started on, so instead of running on a fiber, the fn is called
+ * right away, and its future is done before anything awaits it.
+ */
+Val aot_spawn(VM* vm, Val* fn) {
+    // the result replaces the fn, which keeps it alive
+    fn[0] = aot_call(vm, fn, 0);
+    Val future = new_future(VOID_VAL);
+    as_future(future)->value = fn[0];
+    as_future(future)->done = true;
+    return future;
+}
+
+typedef struct AotRun {
+    VM* vm;
+    Code* program;
+    Val result;
+} AotRun;
+
+static void* run_program(void* arg) {
+    AotRun* run = arg;
+    run->result = run_code(run->vm, run->program, run->vm->stack, 0, NULL);
+    return NULL;
+}
+
+/**
+ * @brief run a program compiled to C and print its value. globals are the
+ * names of the program's own globals, which come after the builtins.
+ */
+int aot_main(Code* program, char** globals, int count) {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    for (int i = 0; i < count; i++) {
+        cvector_push_back(env, ((LexicalBinding){.symbol = intern(globals[i]),
+                                                 .boundValue = VOID_VAL}));
+    }
+    VM vm = new_vm(&env);
+    free(vm.stack);
+    vm.stack = malloc(sizeof(Val) * AOT_STACK_SIZE);
+    vm.stack_end = vm.stack + AOT_STACK_SIZE;
+    vm.sp = vm.stack;
+    gc_add_roots(mark_vm, &vm);
+
+    AotRun run = {.vm = &vm, .program = program};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, AOT_C_STACK_BYTES);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, run_program, &run) != 0) {
+        fprintf(stderr, "couldn't start the program\n");
+        abort();
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    gc_remove_roots(&vm);
+    print_val(run.result);
+    free_vm(&vm);
+    return 0;
+}
+
+// TESTS
+static Val add_params(VM* vm, Val* locals, Fn* fn) {
+    locals[2] = locals[0];
+    locals[3] = locals[1];
+    return aot_binary_call(vm, builtin_val(builtin_add), &locals[2]);
+}
+
+void test_aot_call() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    VM vm = new_vm(&env);
+    Code code;
+    aot_code(&code, add_params, 2, (char*[]){"a", "b"}, 2, 3);
+    vm.stack[0] = new_fn(&code, 0);
+    vm.stack[1] = int_val(2);
+    vm.stack[2] = int_val(3);
+    vm.sp = vm.stack + 3;
+    assert(as_int(aot_call(&vm, vm.stack, 2)) == 5);
+    assert(vm.sp == vm.stack + 3);
+
+    vm.stack[0] = builtin_val(builtin_mul);
+    assert(as_int(aot_call(&vm, vm.stack, 2)) == 6);
+    free_vm(&vm);
+}
+
+void test_emit_c() {
+    char program[] = "(let f (fn (x) (if (== x 0) 1 (f (- x 1))))); (f 3)";
+    Expression* expr = parse_source(program);
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    Code* code = compile(expr, resolve(expr, &env));
+    char* text;
+    size_t size;
+    FILE* out = open_memstream(&text, &size);
+    emit_c(code, env, out);
+    fclose(out);
+    assert(strstr(text, "static Val fn_1(VM* vm, Val* L, Fn* fn) {") != NULL);
+    // the tail call of f to itself is a loop
+    assert(strstr(text, "goto start;") != NULL);
+    assert(strstr(text, "return aot_main(&C[0], (char*[]){\"f\"}, 1);") !=
+           NULL);
+    free(text);
+}
@@ -0,0 +1,44 @@
+#ifndef SPORK_AOT_H_
+#define SPORK_AOT_H_
+#include <stdio.h>
+
+#include "../lib/cvector/cvector.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "compiler.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "memo.h"
+#include "utils.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * A program compiled to C by emit_c includes this header, and links against
+ * the rest of the runtime. The generated code keeps every value it works on in
+ * the slots of its frame on the VM's stack, like the interpreter does, so the
+ * garbage collector can find them.
+ */
+
+void emit_c(Code* program, cvector_vector_type(LexicalBinding) globals,
+            FILE* out);
+
+void aot_code(Code* code, AotFn fn, int argc, char** params, int size,
+              int max_stack);
+Val aot_call(VM* vm, Val* callee, int argc);
+Val aot_binary_call(VM* vm, Val callee, Val* args);
+Val aot_par(VM* vm, Val* fns, int count);
+Val aot_spawn(VM* vm, Val* fn);
+int aot_main(Code* program, char** globals, int count);
+
+static inline bool aot_condition(Val condition) {
+    if (!is_bool(condition)) {
+        runtime_error("condition of if must be a bool");
+    }
+    return as_bool(condition);
+}
+
+// TESTS
+void test_aot_call();
+void test_emit_c();
+#endif
@@ -0,0 +1,398 @@
+#include "async.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "par.h"
+#include "parser.h"
+#include "utils.h"
+
+/**
+ * @brief a VM with a C stack of its own, which runs the fn of future. Once
+ * the future is done, the fiber is kept for the next spawn. While it runs,
+ * caller is the context of whatever resumed it, which it switches back to
+ * when it's done or has to wait for awaiting. pinned counts the forks of
+ * par.c it's in the middle of, which keep it from switching out.
+ */
+typedef struct Fiber {
+    ucontext_t context;
+    ucontext_t* caller;
+    char* stack;
+    VM vm;
+    Future* future;
+    Future* awaiting;
+    int pinned;
+    struct Fiber* next;
+} Fiber;
+
+// guards the queue of ready fibers, the free ones, and the waiters of every
+// future
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Fiber* ready_head = NULL;
+static Fiber* ready_tail = NULL;
+static _Atomic int ready_count = 0;
+static Fiber* free_fibers = NULL;
+// signalled whenever a future is done or a fiber gets ready, for the threads
+// that are blocked in async_await
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int blocked = 0;
+// the fiber the calling thread is running, or NULL if it isn't running one
+static __thread Fiber* current = NULL;
+
+// what a free fiber's VM is bound to
+static cvector_vector_type(LexicalBinding) no_globals = NULL;
+
+static void mark_fiber(void* roots) {
+    Fiber* fiber = roots;
+    mark_vm(&fiber->vm);
+    gc_mark_obj((Obj*)fiber->future);
+    gc_mark_obj((Obj*)fiber->awaiting);
+}
+
+/// @brief put fiber at the end of the queue. The lock must be held.
+static void make_ready(Fiber* fiber) {
+    fiber->next = NULL;
+    if (ready_tail == NULL) {
+        ready_head = fiber;
+    } else {
+        ready_tail->next = fiber;
+    }
+    ready_tail = fiber;
+    atomic_fetch_add(&ready_count, 1);
+    if (blocked > 0) {
+        pthread_cond_broadcast(&changed);
+    }
+}
+
+/**
+ * @brief set the value of future, and make the fibers waiting for it ready
+ */
+static void complete(Future* future, Val value) {
+    pthread_mutex_lock(&lock);
+    future->value = value;
+    future->fn = VOID_VAL;
+    atomic_store_explicit(&future->done, true, memory_order_release);
+    if (blocked > 0) {
+        pthread_cond_broadcast(&changed);
+    }
+    bool woke = future->waiters != NULL;
+    while (future->waiters != NULL) {
+        Fiber* fiber = future->waiters;
+        future->waiters = fiber->next;
+        make_ready(fiber);
+    }
+    pthread_mutex_unlock(&lock);
+    if (woke) {
+        par_wake_workers();
+    }
+}
+
+/**
+ * @brief what every fiber runs, from the first time it's resumed on: the fn
+ * of each future it's given in turn.
+ */
+static void fiber_main(unsigned high, unsigned low) {
+    Fiber* fiber = (Fiber*)(((uintptr_t)high << 32) | low);
+    for (;;) {
+        Future* future = fiber->future;
+        Val value = vm_call(&fiber->vm, future->fn, NULL, 0);
+        complete(future, value);
+        fiber->future = NULL;
+        swapcontext(&fiber->context, fiber->caller);
+    }
+}
+
+static Fiber* new_fiber() {
+    Fiber* fiber = calloc(1, sizeof(Fiber));
+    fiber->stack = mmap(NULL, FIBER_STACK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                        -1, 0);
+    if (fiber->stack == MAP_FAILED) {
+        fprintf(stderr, "couldn't allocate the stack of a fiber\n");
+        abort();
+    }
+    // overflowing the stack faults on its lowest page, instead of writing
+    // over whatever is below it
+    mprotect(fiber->stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber->context.uc_link = NULL;
+    // makecontext passes ints, so the pointer is split in two
+    uintptr_t address = (uintptr_t)fiber;
+    makecontext(&fiber->context, (void (*)())fiber_main, 2,
+                (unsigned)(address >> 32), (unsigned)address);
+    fiber->vm = new_vm(&no_globals);
+    gc_add_roots(mark_fiber, fiber);
+    return fiber;
+}
+
+/**
+ * @brief run fiber on the calling thread until it's done or waits for a
+ * future, and then free it or park it on the future. Whatever calls this
+ * stays on the calling thread in the meantime: it's either not a fiber, or a
+ * pinned one.
+ */
+static void resume(Fiber* fiber) {
+    ucontext_t caller;
+    Fiber* outer = current;
+    fiber->caller = &caller;
+    current = fiber;
+    swapcontext(&caller, &fiber->context);
+    current = outer;
+
+    pthread_mutex_lock(&lock);
+    if (fiber->future == NULL) {
+        fiber->vm.globals = &no_globals;
+        fiber->next = free_fibers;
+        free_fibers = fiber;
+    } else if (atomic_load_explicit(&fiber->awaiting->done,
+                                    memory_order_acquire)) {
+        // completed while the fiber was switching out
+        make_ready(fiber);
+    } else {
+        fiber->next = fiber->awaiting->waiters;
+        fiber->awaiting->waiters = fiber;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief whether there are fibers waiting for a thread to run them
+ */
+bool async_ready() { return atomic_load(&ready_count) > 0; }
+
+/**
+ * @brief resume the fiber that has been ready the longest, if there is one
+ *
+ * @return bool whether there was
+ */
+bool async_run_ready() {
+    if (!async_ready()) {
+        return false;
+    }
+    pthread_mutex_lock(&lock);
+    Fiber* fiber = ready_head;
+    if (fiber != NULL) {
+        ready_head = fiber->next;
+        if (ready_head == NULL) {
+            ready_tail = NULL;
+        }
+        atomic_fetch_sub(&ready_count, 1);
+    }
+    pthread_mutex_unlock(&lock);
+    if (fiber == NULL) {
+        return false;
+    }
+    resume(fiber);
+    return true;
+}
+
+/**
+ * @brief make a future of what fn returns, and queue a fiber to call fn, which
+ * takes no args, with the globals of vm. Idle workers pick it up; if there are
+ * none, it runs once something awaits.
+ *
+ * @param vm
+ * @param fn is kept alive by the caller until this returns
+ * @return Val the future
+ */
+Val async_spawn(VM* vm, Val fn) {
+    par_join_pool();
+    Val future = new_future(fn);
+    pthread_mutex_lock(&lock);
+    Fiber* fiber = free_fibers;
+    if (fiber != NULL) {
+        free_fibers = fiber->next;
+    }
+    pthread_mutex_unlock(&lock);
+    if (fiber == NULL) {
+        fiber = new_fiber();
+    }
+    fiber->vm.globals = vm->globals;
+    fiber->future = as_future(future);
+    pthread_mutex_lock(&lock);
+    make_ready(fiber);
+    pthread_mutex_unlock(&lock);
+    par_wake_workers();
+    return future;
+}
+
+/**
+ * @brief block the calling thread until future is done or a fiber is ready.
+ * Like a sleeping worker, it holds no values in the meantime, so collections
+ * don't wait for it.
+ */
+static void block_until_done(Future* future) {
+    gc_block();
+    pthread_mutex_lock(&lock);
+    blocked++;
+    while (!atomic_load_explicit(&future->done, memory_order_acquire) &&
+           ready_head == NULL) {
+        pthread_cond_wait(&changed, &lock);
+    }
+    blocked--;
+    pthread_mutex_unlock(&lock);
+    gc_unblock();
+}
+
+/**
+ * @brief the value of future, once it's done. A fiber that isn't pinned
+ * switches out until then, so its thread can run something else. Everything
+ * else runs ready fibers in the meantime, one of which will complete it, and
+ * blocks while there are none.
+ *
+ * @param future is kept alive by the caller
+ * @return Val
+ */
+Val async_await(Future* future) {
+    if (atomic_load_explicit(&future->done, memory_order_acquire)) {
+        return future->value;
+    }
+    Fiber* fiber = current;
+    if (fiber != NULL && fiber->pinned == 0) {
+        fiber->awaiting = future;
+        swapcontext(&fiber->context, fiber->caller);
+        // resumed by some thread, once future was done
+        fiber->awaiting = NULL;
+        return future->value;
+    }
+    while (!atomic_load_explicit(&future->done, memory_order_acquire)) {
+        if (!async_run_ready()) {
+            block_until_done(future);
+        }
+    }
+    return future->value;
+}
+
+/// @brief keep the fiber the calling thread is running on this thread
+void async_pin() {
+    if (current != NULL) {
+        current->pinned++;
+    }
+}
+
+void async_unpin() {
+    if (current != NULL) {
+        current->pinned--;
+    }
+}
+
+// TESTS
+static Val run_string(char* program) {
+    // the pool only starts once, so these tests make sure it has threads
+    if (par_threads == 0) {
+        par_threads = 4;
+    }
+    return run_source(program);
+}
+
+void test_async_spawn_await() {
+    char program[] = "(let f (spawn (* 6 7))); (await f)";
+    assert(as_int(run_string(program)) == 42);
+    char nested[] = "(await (await (spawn (spawn 5))))";
+    assert(as_int(run_string(nested)) == 5);
+    // every call awaits a fiber that awaits others in turn
+    char fib[] =
+        "(let fib (fn (n) (if (== n 0) 0 (if (== n 1) 1"
+        "    (let f (spawn (fib (- n 1))));"
+        "    (+ (fib (- n 2)) (await f))))));"
+        "(fib 15)";
+    assert(as_int(run_string(fib)) == 610);
+}
+
+static int count_waiters(Future* future) {
+    int count = 0;
+    pthread_mutex_lock(&lock);
+    for (Fiber* fiber = future->waiters; fiber != NULL; fiber = fiber->next) {
+        count++;
+    }
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void test_async_suspends() {
+    if (par_threads == 0) {
+        par_threads = 4;
+    }
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    VM vm = new_vm(&env);
+    gc_add_roots(mark_vm, &vm);
+    Val gate = new_future(VOID_VAL);
+    gc_pin(gate);
+    char program[] =
+        "(let spawn_all (fn (gate) (let wait (fn (n) (+ (await gate) n)));"
+        "    (tuple (spawn (wait 1)) (spawn (wait 2)) (spawn (wait 3))"
+        "        (spawn (wait 4)) (spawn (wait 5)) (spawn (wait 6))"
+        "        (spawn (wait 7)) (spawn (wait 8)))));"
+        "spawn_all";
+    Val fn = eval(parse_source(program), &env);
+    gc_pin(fn);
+    Val futures = vm_call(&vm, fn, &gate, 1);
+    gc_pin(futures);
+    // more fibers than there are threads wait for gate at once
+    while (count_waiters(as_future(gate)) < 8) {
+        if (!async_run_ready()) {
+            gc_safepoint();
+            sched_yield();
+        }
+    }
+    complete(as_future(gate), int_val(10));
+    for (int i = 0; i < 8; i++) {
+        Val value = async_await(as_future(as_tuple(futures)->values[i]));
+        assert(as_int(value) == 11 + i);
+    }
+    gc_remove_roots(&vm);
+    free_vm(&vm);
+}
+
+static void* complete_later(void* future) {
+    usleep(200 * 1000);
+    complete(future, int_val(7));
+    return NULL;
+}
+
+static double thread_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void test_async_await_blocks() {
+    Val future = new_future(VOID_VAL);
+    gc_pin(future);
+    pthread_t thread;
+    pthread_create(&thread, NULL, complete_later, as_future(future));
+    double start = thread_seconds();
+    assert(as_int(async_await(as_future(future))) == 7);
+    // the thread slept instead of spinning while the future wasn't done
+    assert(thread_seconds() - start < 0.1);
+    pthread_join(thread, NULL);
+}
+
+void test_async_collects() {
+    // every pair is a tuple on the heap, since it's returned
+    char program[] =
+        "(let pair (fn (n) (tuple n n)));"
+        "(let sum (fn (n acc) (if (== n 0) acc"
+        "    (sum (- n 1) (+ acc (nth (pair n) 0))))));"
+        "(let a (spawn (sum 100000 0)));"
+        "(let b (spawn (+ (sum 100000 0) (await a))));"
+        "(+ (await b) (sum 100000 0))";
+    size_t collections = gc_stats().collections;
+    assert(as_int(run_string(program)) == 3 * 5000050000l);
+    assert(gc_stats().collections > collections);
+}
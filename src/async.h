@@ -0,0 +1,36 @@
+#ifndef SPORK_ASYNC_H_
+#define SPORK_ASYNC_H_
+#include "value.h"
+#include "vm.h"
+
+// the C stack of a fiber, as big as a thread's. Only the pages a fiber
+// touches take up memory.
+#define FIBER_STACK_SIZE (8 * 1024 * 1024)
+
+/*
+ * (spawn e) returns a future right away, and evaluates e on a fiber: a VM with
+ * a C stack of its own, which any thread in the pool of par.h can switch to
+ * with swapcontext, so a program can have far more fibers than threads. Ready
+ * fibers wait in one queue, and idle workers take them from it. When a fiber
+ * awaits a future that isn't done, its thread switches back out of it and
+ * parks it on the future, and the fiber that completes the future puts it back
+ * on the queue, from where any thread may resume it. Everything else that
+ * awaits keeps its thread, and runs ready fibers until the future is done,
+ * sleeping whenever there are none: the program itself, tasks of a par, and
+ * fibers in the middle of a par, whose tasks are on the deque of the thread
+ * they are on.
+ */
+
+Val async_spawn(VM* vm, Val fn);
+Val async_await(Future* future);
+bool async_ready();
+bool async_run_ready();
+void async_pin();
+void async_unpin();
+
+// TESTS
+void test_async_spawn_await();
+void test_async_suspends();
+void test_async_await_blocks();
+void test_async_collects();
+#endif
@@ -0,0 +1,459 @@
+#include "bigint.h"
+
+#include <stdlib.h>
+
+#include "../lib/cvector/cvector.h"
+#include "gc.h"
+#include "utils.h"
+
+/*
+ * Arbitrary precision ints. The arithmetic works on magnitudes: arrays of base
+ * 2^32 digits, least significant first, which may have leading zero digits.
+ * Results are normalized, so an int that fits in a long is never a BigInt.
+ */
+
+/**
+ * @brief an int taken apart into its sign and magnitude. The magnitude of an
+ * int that fits in a long is stored in small.
+ */
+typedef struct Operand {
+    bool negative;
+    int size;
+    const uint32_t* digits;
+    uint32_t small[2];
+} Operand;
+
+static void load(Val val, Operand* operand) {
+    if (is_bigint(val)) {
+        BigInt* big = as_bigint(val);
+        operand->negative = big->negative;
+        operand->size = big->size;
+        operand->digits = big->digits;
+        return;
+    }
+    long i = as_int(val);
+    // negating in unsigned arithmetic is fine for LONG_MIN too
+    uint64_t magnitude = i < 0 ? -(uint64_t)i : (uint64_t)i;
+    operand->negative = i < 0;
+    operand->small[0] = (uint32_t)magnitude;
+    operand->small[1] = (uint32_t)(magnitude >> 32);
+    operand->size = 2;
+    operand->digits = operand->small;
+}
+
+static int trim(const uint32_t* digits, int size) {
+    while (size > 0 && digits[size - 1] == 0) {
+        size--;
+    }
+    return size;
+}
+
+static uint32_t* new_digits(int size) {
+    // calloc(0) may return NULL, which is fine since it's never read
+    return calloc(size > 0 ? size : 1, sizeof(uint32_t));
+}
+
+/**
+ * @brief make the int with the given sign and magnitude, as a small int if it
+ * fits in a long.
+ */
+static Val make_int(bool negative, const uint32_t* digits, int size) {
+    size = trim(digits, size);
+    if (size <= 2) {
+        uint64_t magnitude = size == 0 ? 0 : digits[0];
+        if (size == 2) {
+            magnitude |= (uint64_t)digits[1] << 32;
+        }
+        if (!negative && magnitude <= LONG_MAX) {
+            return int_val((long)magnitude);
+        }
+        if (negative && magnitude <= (uint64_t)LONG_MAX + 1) {
+            return int_val((long)(0 - magnitude));
+        }
+    }
+    BigInt* big =
+        (BigInt*)gc_alloc(BigIntObj, sizeof(BigInt) + sizeof(uint32_t) * size);
+    big->negative = negative;
+    big->size = size;
+    memcpy(big->digits, digits, sizeof(uint32_t) * size);
+    return obj_val(&big->obj);
+}
+
+static int compare_magnitudes(const uint32_t* a, int a_size, const uint32_t* b,
+                              int b_size) {
+    a_size = trim(a, a_size);
+    b_size = trim(b, b_size);
+    if (a_size != b_size) {
+        return a_size < b_size ? -1 : 1;
+    }
+    for (int i = a_size - 1; i >= 0; i--) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief add x, shifted up by shift digits, to the size digits of out. The sum
+ * has to fit in them.
+ */
+static void add_into(uint32_t* out, int size, const uint32_t* x, int x_size,
+                     int shift) {
+    x_size = trim(x, x_size);
+    uint64_t carry = 0;
+    int i = 0;
+    for (; i < x_size; i++) {
+        carry += (uint64_t)out[shift + i] + x[i];
+        out[shift + i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (i += shift; carry != 0 && i < size; i++) {
+        carry += out[i];
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+/// @brief subtract y from the size digits of x, which must be at least y
+static void sub_from(uint32_t* x, int size, const uint32_t* y, int y_size) {
+    y_size = trim(y, y_size);
+    int64_t borrow = 0;
+    int i = 0;
+    for (; i < y_size; i++) {
+        int64_t difference = (int64_t)x[i] - y[i] - borrow;
+        borrow = difference < 0;
+        x[i] = (uint32_t)difference;
+    }
+    for (; borrow != 0 && i < size; i++) {
+        borrow = x[i] == 0;
+        x[i]--;
+    }
+}
+
+static void multiply(const uint32_t* a, int a_size, const uint32_t* b,
+                     int b_size, uint32_t* out);
+
+static void schoolbook(const uint32_t* a, int a_size, const uint32_t* b,
+                       int b_size, uint32_t* out) {
+    for (int i = 0; i < a_size; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < b_size; j++) {
+            carry += (uint64_t)a[i] * b[j] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + b_size] = (uint32_t)carry;
+    }
+}
+
+/**
+ * @brief split a and b at half their digits into a1 B^half + a0, and likewise
+ * for b. Then ab = z2 B^2half + z1 B^half + z0, where z0 = a0 b0, z2 = a1 b1
+ * and z1 = (a0 + a1)(b0 + b1) - z0 - z2, which takes 3 products of half the
+ * size instead of 4.
+ */
+static void karatsuba(const uint32_t* a, int a_size, const uint32_t* b,
+                      int b_size, uint32_t* out) {
+    int half = a_size / 2;
+    int out_size = a_size + b_size;
+    if (b_size <= half) {
+        // b is too short to split, so it multiplies each half of a instead
+        uint32_t* high = new_digits(a_size - half + b_size);
+        multiply(a, half, b, b_size, out);
+        multiply(a + half, a_size - half, b, b_size, high);
+        add_into(out, out_size, high, a_size - half + b_size, half);
+        free(high);
+        return;
+    }
+    int a1_size = a_size - half;
+    int b1_size = b_size - half;
+    uint32_t* z0 = new_digits(2 * half);
+    uint32_t* z2 = new_digits(a1_size + b1_size);
+    multiply(a, half, b, half, z0);
+    multiply(a + half, a1_size, b + half, b1_size, z2);
+
+    // a1 is at least as long as a0, but b1 may be shorter than b0
+    int a_sum_size = a1_size + 1;
+    int b_sum_size = (b1_size > half ? b1_size : half) + 1;
+    uint32_t* a_sum = new_digits(a_sum_size);
+    uint32_t* b_sum = new_digits(b_sum_size);
+    memcpy(a_sum, a + half, sizeof(uint32_t) * a1_size);
+    memcpy(b_sum, b + half, sizeof(uint32_t) * b1_size);
+    add_into(a_sum, a_sum_size, a, half, 0);
+    add_into(b_sum, b_sum_size, b, half, 0);
+    int z1_size = a_sum_size + b_sum_size;
+    uint32_t* z1 = new_digits(z1_size);
+    multiply(a_sum, a_sum_size, b_sum, b_sum_size, z1);
+    sub_from(z1, z1_size, z0, 2 * half);
+    sub_from(z1, z1_size, z2, a1_size + b1_size);
+
+    add_into(out, out_size, z0, 2 * half, 0);
+    add_into(out, out_size, z1, z1_size, half);
+    add_into(out, out_size, z2, a1_size + b1_size, 2 * half);
+    free(z0);
+    free(z1);
+    free(z2);
+    free(a_sum);
+    free(b_sum);
+}
+
+/**
+ * @brief store the product of a and b in out, which has a_size + b_size digits
+ * that are all 0.
+ */
+static void multiply(const uint32_t* a, int a_size, const uint32_t* b,
+                     int b_size, uint32_t* out) {
+    a_size = trim(a, a_size);
+    b_size = trim(b, b_size);
+    if (a_size < b_size) {
+        const uint32_t* digits = a;
+        a = b;
+        b = digits;
+        int size = a_size;
+        a_size = b_size;
+        b_size = size;
+    }
+    if (b_size < KARATSUBA_THRESHOLD) {
+        schoolbook(a, a_size, b, b_size, out);
+    } else {
+        karatsuba(a, a_size, b, b_size, out);
+    }
+}
+
+/**
+ * @brief the sum of a and b, where b is negated first if negate_b is set
+ */
+static Val add(Val a, Val b, bool negate_b) {
+    Operand x, y;
+    load(a, &x);
+    load(b, &y);
+    y.negative ^= negate_b;
+    int size = (x.size > y.size ? x.size : y.size) + 1;
+    uint32_t* digits = new_digits(size);
+    bool negative;
+    if (x.negative == y.negative) {
+        memcpy(digits, x.digits, sizeof(uint32_t) * x.size);
+        add_into(digits, size, y.digits, y.size, 0);
+        negative = x.negative;
+    } else {
+        // subtract the smaller magnitude from the larger one
+        if (compare_magnitudes(x.digits, x.size, y.digits, y.size) < 0) {
+            memcpy(digits, y.digits, sizeof(uint32_t) * y.size);
+            sub_from(digits, size, x.digits, x.size);
+            negative = y.negative;
+        } else {
+            memcpy(digits, x.digits, sizeof(uint32_t) * x.size);
+            sub_from(digits, size, y.digits, y.size);
+            negative = x.negative;
+        }
+    }
+    Val sum = make_int(negative, digits, size);
+    free(digits);
+    return sum;
+}
+
+Val bigint_add(Val a, Val b) { return add(a, b, false); }
+
+Val bigint_sub(Val a, Val b) { return add(a, b, true); }
+
+Val bigint_mul(Val a, Val b) {
+    Operand x, y;
+    load(a, &x);
+    load(b, &y);
+    int size = x.size + y.size;
+    uint32_t* digits = new_digits(size);
+    multiply(x.digits, x.size, y.digits, y.size, digits);
+    Val product = make_int(x.negative != y.negative, digits, size);
+    free(digits);
+    return product;
+}
+
+/**
+ * @brief divide the size digits of x by the single digit divisor in place.
+ *
+ * @return uint32_t the remainder
+ */
+static uint32_t divide_digit(uint32_t* x, int size, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        remainder = (remainder << 32) | x[i];
+        x[i] = (uint32_t)(remainder / divisor);
+        remainder %= divisor;
+    }
+    return (uint32_t)remainder;
+}
+
+/**
+ * @brief the quotient of a and b, rounded towards zero like C does.
+ */
+Val bigint_div(Val a, Val b) {
+    Operand x, y;
+    load(a, &x);
+    load(b, &y);
+    y.size = trim(y.digits, y.size);
+    if (y.size == 0) {
+        runtime_error("division by zero");
+    }
+    uint32_t* quotient = new_digits(x.size);
+    memcpy(quotient, x.digits, sizeof(uint32_t) * x.size);
+    if (y.size == 1) {
+        divide_digit(quotient, x.size, y.digits[0]);
+    } else {
+        // long division a bit at a time, which is slow but only needed for
+        // divisors that don't fit in a digit
+        memset(quotient, 0, sizeof(uint32_t) * x.size);
+        uint32_t* remainder = new_digits(y.size + 1);
+        for (int i = x.size * 32 - 1; i >= 0; i--) {
+            for (int j = y.size; j > 0; j--) {
+                remainder[j] = (remainder[j] << 1) | (remainder[j - 1] >> 31);
+            }
+            remainder[0] = (remainder[0] << 1) | ((x.digits[i / 32] >> i % 32) & 1);
+            if (compare_magnitudes(remainder, y.size + 1, y.digits, y.size) >= 0) {
+                sub_from(remainder, y.size + 1, y.digits, y.size);
+                quotient[i / 32] |= 1u << i % 32;
+            }
+        }
+        free(remainder);
+    }
+    Val result = make_int(x.negative != y.negative, quotient, x.size);
+    free(quotient);
+    return result;
+}
+
+bool bigint_eq(Val a, Val b) {
+    if (is_int(a) || is_int(b)) {
+        // only one of them fits in a long, or they would be compared as longs
+        return is_int(a) && is_int(b) && as_int(a) == as_int(b);
+    }
+    BigInt* x = as_bigint(a);
+    BigInt* y = as_bigint(b);
+    return x->negative == y->negative &&
+           compare_magnitudes(x->digits, x->size, y->digits, y->size) == 0;
+}
+
+/**
+ * @brief the decimal digits of an int, found 9 at a time by dividing by 10^9.
+ */
+sds bigint_to_string(Val val) {
+    Operand x;
+    load(val, &x);
+    uint32_t* digits = new_digits(x.size);
+    memcpy(digits, x.digits, sizeof(uint32_t) * x.size);
+    int size = trim(digits, x.size);
+    cvector_vector_type(uint32_t) chunks = NULL;
+    do {
+        cvector_push_back(chunks, divide_digit(digits, size, 1000000000));
+        size = trim(digits, size);
+    } while (size > 0);
+    sds string = sdsnew(x.negative ? "-" : "");
+    string = sdscatprintf(string, "%u", chunks[cvector_size(chunks) - 1]);
+    for (int i = cvector_size(chunks) - 2; i >= 0; i--) {
+        string = sdscatprintf(string, "%09u", chunks[i]);
+    }
+    cvector_free(chunks);
+    free(digits);
+    return string;
+}
+
+/*
+ * Arithmetic on any two ints, for callers that know they have ints but not
+ * which representation.
+ */
+
+static bool are_longs(Val a, Val b) { return is_int(a) && is_int(b); }
+
+Val integer_add(Val a, Val b) {
+    return are_longs(a, b) ? int_add(as_int(a), as_int(b)) : bigint_add(a, b);
+}
+
+Val integer_sub(Val a, Val b) {
+    return are_longs(a, b) ? int_sub(as_int(a), as_int(b)) : bigint_sub(a, b);
+}
+
+Val integer_mul(Val a, Val b) {
+    return are_longs(a, b) ? int_mul(as_int(a), as_int(b)) : bigint_mul(a, b);
+}
+
+Val integer_div(Val a, Val b) {
+    if (!are_longs(a, b)) {
+        return bigint_div(a, b);
+    }
+    if (as_int(b) == 0) {
+        runtime_error("division by zero");
+    }
+    return int_div(as_int(a), as_int(b));
+}
+
+Val integer_eq(Val a, Val b) {
+    return bool_val(are_longs(a, b) ? as_int(a) == as_int(b) : bigint_eq(a, b));
+}
+
+// TESTS
+static Val parse_int(const char* decimal) {
+    bool negative = *decimal == '-';
+    Val val = int_val(0);
+    for (const char* c = decimal + negative; *c != '\0'; c++) {
+        val = bigint_add(bigint_mul(val, int_val(10)), int_val(*c - '0'));
+    }
+    return negative ? bigint_sub(int_val(0), val) : val;
+}
+
+static bool has_digits(Val val, const char* decimal) {
+    sds string = bigint_to_string(val);
+    bool equal = strcmp(string, decimal) == 0;
+    sdsfree(string);
+    return equal;
+}
+
+void test_bigint_promotes() {
+    Val max = int_add(LONG_MAX, 1);
+    assert(is_bigint(max));
+    assert(has_digits(max, "9223372036854775808"));
+    // and demotes once it fits again
+    Val back = bigint_sub(max, int_val(1));
+    assert(is_int(back) && as_int(back) == LONG_MAX);
+    assert(is_int(int_sub(LONG_MIN, 0)));
+    assert(has_digits(int_sub(LONG_MIN, 1), "-9223372036854775809"));
+    assert(has_digits(int_mul(LONG_MAX, LONG_MAX),
+                      "85070591730234615847396907784232501249"));
+    assert(has_digits(int_div(LONG_MIN, -1), "9223372036854775808"));
+    assert(as_int(int_mul(-4, 5)) == -20);
+    assert(bigint_eq(parse_int("123456789012345678901234567890"),
+                     parse_int("123456789012345678901234567890")));
+    assert(!bigint_eq(max, int_val(1)));
+}
+
+void test_bigint_karatsuba() {
+    // (10^1200 - 1)^2 = 10^2400 - 2 * 10^1200 + 1, whose halves are big
+    // enough for karatsuba too
+    Val nines = int_val(0);
+    for (int i = 0; i < 1200; i++) {
+        nines = bigint_add(bigint_mul(nines, int_val(10)), int_val(9));
+    }
+    assert(as_bigint(nines)->size >= 2 * KARATSUBA_THRESHOLD);
+    sds expected = sdsempty();
+    for (int i = 0; i < 1199; i++) {
+        expected = sdscat(expected, "9");
+    }
+    expected = sdscat(expected, "8");
+    for (int i = 0; i < 1199; i++) {
+        expected = sdscat(expected, "0");
+    }
+    expected = sdscat(expected, "1");
+    assert(has_digits(bigint_mul(nines, nines), expected));
+    // and a product of numbers of very different sizes
+    Val short_one = parse_int("-18446744073709551617");
+    assert(bigint_eq(bigint_div(bigint_mul(nines, short_one), short_one),
+                     nines));
+    sdsfree(expected);
+}
+
+void test_bigint_div() {
+    Val a = parse_int("-1000000000000000000000000000007");
+    Val b = parse_int("100000000000000000003");
+    assert(has_digits(bigint_div(a, b), "-9999999999"));
+    assert(has_digits(bigint_div(a, int_val(7)),
+                      "-142857142857142857142857142858"));
+    assert(has_digits(bigint_div(b, a), "0"));
+}
@@ -0,0 +1,60 @@
+#ifndef SPORK_BIGINT_H_
+#define SPORK_BIGINT_H_
+#include <limits.h>
+
+#include "../lib/sds/sds.h"
+#include "value.h"
+
+// products of numbers with fewer 32 bit digits than this are computed the
+// schoolbook way, which beats Karatsuba's extra additions on small numbers
+#define KARATSUBA_THRESHOLD 32
+
+Val bigint_add(Val a, Val b);
+Val bigint_sub(Val a, Val b);
+Val bigint_mul(Val a, Val b);
+Val bigint_div(Val a, Val b);
+bool bigint_eq(Val a, Val b);
+sds bigint_to_string(Val val);
+Val integer_add(Val a, Val b);
+Val integer_sub(Val a, Val b);
+Val integer_mul(Val a, Val b);
+Val integer_div(Val a, Val b);
+Val integer_eq(Val a, Val b);
+
+static inline bool is_integer(Val val) { return is_int(val) || is_bigint(val); }
+
+/*
+ * Arithmetic on ints that fit in a long, which only leaves the machine's
+ * arithmetic when the result doesn't fit in a long anymore.
+ */
+
+static inline Val int_add(long x, long y) {
+    long z;
+    return __builtin_add_overflow(x, y, &z) ? bigint_add(int_val(x), int_val(y))
+                                            : int_val(z);
+}
+
+static inline Val int_sub(long x, long y) {
+    long z;
+    return __builtin_sub_overflow(x, y, &z) ? bigint_sub(int_val(x), int_val(y))
+                                            : int_val(z);
+}
+
+static inline Val int_mul(long x, long y) {
+    long z;
+    return __builtin_mul_overflow(x, y, &z) ? bigint_mul(int_val(x), int_val(y))
+                                            : int_val(z);
+}
+
+/// @brief y must not be 0
+static inline Val int_div(long x, long y) {
+    // the only quotient that overflows is LONG_MIN / -1
+    return (y == -1 && x == LONG_MIN) ? bigint_div(int_val(x), int_val(y))
+                                      : int_val(x / y);
+}
+
+// TESTS
+void test_bigint_promotes();
+void test_bigint_karatsuba();
+void test_bigint_div();
+#endif
@@ -0,0 +1,130 @@
+#include "builtins.h"
+
+#include <stdio.h>
+
+#include "async.h"
+#include "bigint.h"
+#include "interpreter.h"
+#include "par.h"
+#include "utils.h"
+
+static void assert_binary_int_op(Val* args, int argc) {
+    assert(argc == 2);
+    assert(is_integer(args[0]));
+    assert(is_integer(args[1]));
+}
+
+Val builtin_add(VM* vm, Val* args, int argc) {
+    assert_binary_int_op(args, argc);
+    return integer_add(args[0], args[1]);
+}
+
+Val builtin_sub(VM* vm, Val* args, int argc) {
+    assert_binary_int_op(args, argc);
+    return integer_sub(args[0], args[1]);
+}
+
+Val builtin_mul(VM* vm, Val* args, int argc) {
+    assert_binary_int_op(args, argc);
+    return integer_mul(args[0], args[1]);
+}
+
+Val builtin_div(VM* vm, Val* args, int argc) {
+    assert_binary_int_op(args, argc);
+    return integer_div(args[0], args[1]);
+}
+
+Val builtin_eq(VM* vm, Val* args, int argc) {
+    assert_binary_int_op(args, argc);
+    return integer_eq(args[0], args[1]);
+}
+
+Val builtin_print(VM* vm, Val* args, int argc) {
+    assert(argc == 1);
+    assert(is_string(args[0]));
+    printf("%s", as_string(args[0]));
+    return VOID_VAL;
+}
+
+Val builtin_tuple(VM* vm, Val* args, int argc) {
+    Val tuple = new_tuple(argc);
+    for (int i = 0; i < argc; i++) {
+        as_tuple(tuple)->values[i] = args[i];
+    }
+    return tuple;
+}
+
+Val builtin_nth(VM* vm, Val* args, int argc) {
+    assert(argc == 2);
+    if (!is_tuple(args[0]) || !is_int(args[1])) {
+        runtime_error("nth expects a tuple and an int");
+    }
+    Tuple* tuple = as_tuple(args[0]);
+    long index = as_int(args[1]);
+    if (index < 0 || index >= tuple->size) {
+        runtime_error("tuple index out of range");
+    }
+    return tuple->values[index];
+}
+
+Val builtin_pmap(VM* vm, Val* args, int argc) {
+    assert(argc == 2);
+    if (!is_tuple(args[1])) {
+        runtime_error("pmap expects a fn and a tuple");
+    }
+    return par_map(vm, args[0], as_tuple(args[1]));
+}
+
+Val builtin_pfilter(VM* vm, Val* args, int argc) {
+    assert(argc == 2);
+    if (!is_tuple(args[1])) {
+        runtime_error("pfilter expects a fn and a tuple");
+    }
+    return par_filter(vm, args[0], as_tuple(args[1]));
+}
+
+Val builtin_preduce(VM* vm, Val* args, int argc) {
+    assert(argc == 3);
+    if (!is_tuple(args[2])) {
+        runtime_error("preduce expects a fn, a value and a tuple");
+    }
+    return par_reduce(vm, args[0], args[1], as_tuple(args[2]));
+}
+
+Val builtin_await(VM* vm, Val* args, int argc) {
+    assert(argc == 1);
+    if (!is_future(args[0])) {
+        runtime_error("await expects a future");
+    }
+    return async_await(as_future(args[0]));
+}
+
+typedef struct BuiltinEntry {
+    char* name;
+    BuiltinFn fn;
+} BuiltinEntry;
+
+static BuiltinEntry builtins[] = {
+    {.name = "+", .fn = builtin_add},  {.name = "-", .fn = builtin_sub},
+    {.name = "==", .fn = builtin_eq},  {.name = "*", .fn = builtin_mul},
+    {.name = "/", .fn = builtin_div},  {.name = "print", .fn = builtin_print},
+    {.name = "tuple", .fn = builtin_tuple}, {.name = "nth", .fn = builtin_nth},
+    {.name = "pmap", .fn = builtin_pmap},
+    {.name = "pfilter", .fn = builtin_pfilter},
+    {.name = "preduce", .fn = builtin_preduce},
+    {.name = "await", .fn = builtin_await},
+};
+
+/**
+ * @brief bind every builtin function to its name in the provided environment
+ *
+ * @param env
+ */
+void add_builtins(cvector_vector_type(LexicalBinding) * env) {
+    for (int i = 0; i < ARRAY_LEN(builtins); i++) {
+        LexicalBinding binding = {
+            .symbol = intern(builtins[i].name),
+            .boundValue = builtin_val(builtins[i].fn)};
+        cvector_push_back(*env, binding);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef SPORK_BUILTINS_H_
+#define SPORK_BUILTINS_H_
+#include "../lib/cvector/cvector.h"
+#include "interpreter.h"
+#include "vm.h"
+
+Val builtin_add(VM* vm, Val* args, int argc);
+Val builtin_sub(VM* vm, Val* args, int argc);
+Val builtin_mul(VM* vm, Val* args, int argc);
+Val builtin_div(VM* vm, Val* args, int argc);
+Val builtin_eq(VM* vm, Val* args, int argc);
+Val builtin_print(VM* vm, Val* args, int argc);
+Val builtin_tuple(VM* vm, Val* args, int argc);
+Val builtin_nth(VM* vm, Val* args, int argc);
+Val builtin_pmap(VM* vm, Val* args, int argc);
+Val builtin_pfilter(VM* vm, Val* args, int argc);
+Val builtin_preduce(VM* vm, Val* args, int argc);
+Val builtin_await(VM* vm, Val* args, int argc);
+
+void add_builtins(cvector_vector_type(LexicalBinding) * env);
+#endif
@@ -0,0 +1,456 @@
+#include "compiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "typechecker.h"
+#include "utils.h"
+
+static void compile_expr(Code* code, Expression* expr, bool tail);
+
+static Code* new_code(cvector_vector_type(Symbol) params, Expression* body,
+                      FrameLayout frame) {
+    Code* code = malloc(sizeof(Code));
+    *code = (Code){.instructions = NULL,
+                   .constants = NULL,
+                   .functions = NULL,
+                   .params = params,
+                   .body = body,
+                   .frame = frame,
+                   .max_stack = 0,
+                   .stack_depth = 0,
+                   .calls = 0,
+                   .native = NULL,
+                   .aot = NULL,
+                   .memo = false};
+    return code;
+}
+
+/**
+ * @brief the number of values an instruction leaves on the stack, minus the
+ * number it takes off.
+ */
+int stack_effect(OpCode op, int arg) {
+    switch (op) {
+        case ConstOp:
+        case LoadGlobalOp:
+        case LoadLocalOp:
+        case LoadCaptureOp:
+        case FnOp:
+        case VoidOp:
+            return 1;
+        case StoreGlobalOp:
+        case StoreLocalOp:
+        case JumpIfFalseOp:
+        case PopOp:
+        case ReturnOp:
+            return -1;
+        case CallOp:
+        case TailCallOp:
+        case ScratchTupleOp:
+            return -arg;
+        case ParOp:
+            return 1 - arg;
+        case SpawnOp:
+            return 0;
+        case AddOp:
+        case SubOp:
+        case MulOp:
+        case DivOp:
+        case EqOp:
+        case AddIntOp:
+        case SubIntOp:
+        case MulIntOp:
+        case DivIntOp:
+        case EqIntOp:
+            return -1;
+        case JumpOp:
+            return 0;
+    }
+    abort();
+}
+
+/**
+ * @brief append an instruction to code
+ *
+ * @param code
+ * @param op
+ * @param arg
+ * @return int the index of the emitted instruction, so that jumps can be
+ * patched once their target is known.
+ */
+static int emit(Code* code, OpCode op, int arg) {
+    cvector_push_back(code->instructions, ((Instruction){.op = op, .arg = arg}));
+    code->stack_depth += stack_effect(op, arg);
+    if (code->stack_depth > code->max_stack) {
+        code->max_stack = code->stack_depth;
+    }
+    return cvector_size(code->instructions) - 1;
+}
+
+static void patch_jump(Code* code, int jump) {
+    code->instructions[jump].arg = cvector_size(code->instructions);
+}
+
+static int add_constant(Code* code, Val val) {
+    gc_pin(val);
+    cvector_push_back(code->constants, val);
+    return cvector_size(code->constants) - 1;
+}
+
+/**
+ * @brief compile the rest of the chain after expr. The value of expr is on top
+ * of the stack, and it is the value of the chain if nothing follows it.
+ *
+ * @param code
+ * @param expr
+ * @param tail whether the chain is in tail position
+ */
+static void compile_chain(Code* code, Expression* expr, bool tail) {
+    if (expr->chain) {
+        emit(code, PopOp, 0);
+        compile_expr(code, expr->chain, tail);
+    }
+}
+
+static void compile_comment(Code* code, Expression* expr, bool tail) {
+    emit(code, VoidOp, 0);
+}
+
+static void compile_let(Code* code, Expression* expr, bool tail) {
+    assert(cvector_size(expr->data.expr) == 3);
+    Address address = expr->data.expr[1]->address;
+    compile_expr(code, expr->data.expr[2], false);
+    if (address.kind == GlobalAddress) {
+        emit(code, StoreGlobalOp, address.slot);
+    } else {
+        assert(address.kind == LocalAddress);
+        emit(code, StoreLocalOp, address.slot);
+    }
+    emit(code, VoidOp, 0);
+}
+
+static void compile_if(Code* code, Expression* expr, bool tail) {
+    assert(cvector_size(expr->data.expr) == 4);
+    compile_expr(code, expr->data.expr[1], false);
+    int jump_to_else = emit(code, JumpIfFalseOp, -1);
+    int stack_depth = code->stack_depth;
+    compile_expr(code, expr->data.expr[2], tail);
+    int jump_to_end = emit(code, JumpOp, -1);
+    // only one of the branches runs, so the else branch starts with the stack
+    // as it was before the if branch
+    code->stack_depth = stack_depth;
+    patch_jump(code, jump_to_else);
+    compile_expr(code, expr->data.expr[3], tail);
+    patch_jump(code, jump_to_end);
+}
+
+static void compile_fn(Code* code, Expression* expr, bool tail) {
+    assert(cvector_size(expr->data.expr) == 3);
+    assert(!expr->data.expr[1]->atomic);
+    cvector_vector_type(Expression*) param_expr = expr->data.expr[1]->data.expr;
+    cvector_vector_type(Symbol) params = NULL;
+    for (int i = 0; i < cvector_size(param_expr); i++) {
+        assert(param_expr[i]->atomic);
+        assert(param_expr[i]->data.atom.kind == SymbolAtom);
+        cvector_push_back(params, param_expr[i]->data.atom.type.symbol);
+    }
+
+    Code* fn_code = new_code(params, expr->data.expr[2], expr->frame);
+    compile_expr(fn_code, fn_code->body, true);
+    emit(fn_code, ReturnOp, 0);
+
+    cvector_push_back(code->functions, fn_code);
+    emit(code, FnOp, cvector_size(code->functions) - 1);
+}
+
+static void compile_memo(Code* code, Expression* expr, bool tail) {
+    assert(cvector_size(expr->data.expr) == 2);
+    compile_fn(code, expr->data.expr[1], tail);
+    code->functions[cvector_size(code->functions) - 1]->memo = true;
+}
+
+static void compile_symbol(Code* code, Expression* expr) {
+    Address address = expr->address;
+    switch (address.kind) {
+        case GlobalAddress:
+            emit(code, LoadGlobalOp, address.slot);
+            break;
+        case LocalAddress:
+            emit(code, LoadLocalOp, address.slot);
+            break;
+        case CaptureAddress:
+            emit(code, LoadCaptureOp, address.slot);
+            break;
+        case UnresolvedAddress:
+            abort();
+    }
+}
+
+static void compile_atom(Code* code, Expression* expr) {
+    if (expr->data.atom.kind == SymbolAtom) {
+        compile_symbol(code, expr);
+    } else {
+        Val literal = literal_val(expr->data.atom.type.literal);
+        emit(code, ConstOp, add_constant(code, literal));
+    }
+}
+
+typedef struct BinaryOp {
+    char* name;
+    OpCode op;
+    OpCode int_op;
+    Symbol symbol;
+} BinaryOp;
+
+/**
+ * @brief the builtins that calls with two args are compiled to an instruction
+ * for. The instruction runs the operation on two ints straight off the stack,
+ * as long as the global it was called through is still bound to the builtin.
+ * Anything else falls back to a regular call of the global. Calls that the
+ * typechecker proved are of the builtin on two ints (see int_args) are
+ * compiled to int_op instead, which skips those checks.
+ */
+static BinaryOp binary_ops[] = {
+    {.name = "+", .op = AddOp, .int_op = AddIntOp},
+    {.name = "-", .op = SubOp, .int_op = SubIntOp},
+    {.name = "*", .op = MulOp, .int_op = MulIntOp},
+    {.name = "/", .op = DivOp, .int_op = DivIntOp},
+    {.name = "==", .op = EqOp, .int_op = EqIntOp}};
+
+/**
+ * @brief the builtin that callee names, if there is an instruction for it
+ */
+static BinaryOp* get_binary_op(Expression* callee) {
+    if (binary_ops[0].symbol == NULL) {
+        for (int i = 0; i < ARRAY_LEN(binary_ops); i++) {
+            binary_ops[i].symbol = intern(binary_ops[i].name);
+        }
+    }
+    if (!callee->atomic || callee->data.atom.kind != SymbolAtom ||
+        callee->address.kind != GlobalAddress) {
+        return NULL;
+    }
+    for (int i = 0; i < ARRAY_LEN(binary_ops); i++) {
+        if (binary_ops[i].symbol == callee->data.atom.type.symbol) {
+            return &binary_ops[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief call a function, which includes builtin functions
+ */
+static void compile_call(Code* code, Expression* expr, bool tail) {
+    if (cvector_size(expr->data.expr) == 0) {
+        syntax_error("cannot evaluate an empty expression");
+    }
+    Expression* callee = expr->data.expr[0];
+    BinaryOp* op = get_binary_op(callee);
+    if (op != NULL && cvector_size(expr->data.expr) == 3) {
+        compile_expr(code, expr->data.expr[1], false);
+        compile_expr(code, expr->data.expr[2], false);
+        if (expr->int_args) {
+            emit(code, op->int_op, 0);
+            return;
+        }
+        // falling back to a call pushes the callee below the two args
+        if (code->stack_depth + 1 > code->max_stack) {
+            code->max_stack = code->stack_depth + 1;
+        }
+        emit(code, op->op, callee->address.slot);
+        return;
+    }
+    for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+        compile_expr(code, expr->data.expr[i], false);
+    }
+    int argc = cvector_size(expr->data.expr) - 1;
+    if (expr->scratch) {
+        emit(code, ScratchTupleOp, argc);
+    } else {
+        emit(code, tail ? TailCallOp : CallOp, argc);
+    }
+}
+
+/**
+ * @brief evaluate the expressions of a par, each of which the parser made the
+ * body of a fn, in parallel (see par.h)
+ */
+static void compile_par(Code* code, Expression* expr) {
+    int count = cvector_size(expr->data.expr) - 1;
+    for (int i = 1; i <= count; i++) {
+        compile_expr(code, expr->data.expr[i], false);
+    }
+    // the tuple of results is pushed above the fns while they run
+    if (code->stack_depth + 1 > code->max_stack) {
+        code->max_stack = code->stack_depth + 1;
+    }
+    emit(code, ParOp, count);
+}
+
+/**
+ * @brief emit instructions that push the value of expr (including the rest of
+ * its chain) onto the stack.
+ *
+ * @param code
+ * @param expr
+ * @param tail whether the value of expr is returned from the function being
+ * compiled as soon as it's computed. Calls in tail position replace the frame
+ * of the caller instead of pushing a new one.
+ */
+static void compile_expr(Code* code, Expression* expr, bool tail) {
+    // only the last expression of a chain can be in tail position
+    bool expr_tail = tail && expr->chain == NULL;
+    switch (expr->form) {
+        case AtomForm:
+            compile_atom(code, expr);
+            break;
+        case CommentForm:
+            compile_comment(code, expr, expr_tail);
+            break;
+        case LetForm:
+            compile_let(code, expr, expr_tail);
+            break;
+        case FnForm:
+            compile_fn(code, expr, expr_tail);
+            break;
+        case IfForm:
+            compile_if(code, expr, expr_tail);
+            break;
+        case MemoForm:
+            compile_memo(code, expr, expr_tail);
+            break;
+        case CallForm:
+            compile_call(code, expr, expr_tail);
+            break;
+        case ParForm:
+            compile_par(code, expr);
+            break;
+        case SpawnForm:
+            // the parser made the expression the body of a fn (see async.h)
+            compile_expr(code, expr->data.expr[1], false);
+            emit(code, SpawnOp, 0);
+            break;
+    }
+    compile_chain(code, expr, tail);
+}
+
+/**
+ * @brief compile a resolved program into bytecode for the VM. The program is
+ * compiled as the body of a function that takes no params.
+ *
+ * @param expr
+ * @param frame the frame the program needs, as returned by `resolve`
+ * @return Code*
+ */
+Code* compile(Expression* expr, FrameLayout frame) {
+    Code* code = new_code(NULL, expr, frame);
+    compile_expr(code, expr, true);
+    emit(code, ReturnOp, 0);
+    return code;
+}
+
+static char* op_names[] = {[ConstOp] = "const",
+                           [LoadGlobalOp] = "load_global",
+                           [StoreGlobalOp] = "store_global",
+                           [LoadLocalOp] = "load_local",
+                           [StoreLocalOp] = "store_local",
+                           [LoadCaptureOp] = "load_capture",
+                           [FnOp] = "fn",
+                           [CallOp] = "call",
+                           [TailCallOp] = "tail_call",
+                           [ScratchTupleOp] = "scratch_tuple",
+                           [ParOp] = "par",
+                           [SpawnOp] = "spawn",
+                           [AddOp] = "add",
+                           [SubOp] = "sub",
+                           [MulOp] = "mul",
+                           [DivOp] = "div",
+                           [EqOp] = "eq",
+                           [AddIntOp] = "add_int",
+                           [SubIntOp] = "sub_int",
+                           [MulIntOp] = "mul_int",
+                           [DivIntOp] = "div_int",
+                           [EqIntOp] = "eq_int",
+                           [JumpOp] = "jump",
+                           [JumpIfFalseOp] = "jump_if_false",
+                           [PopOp] = "pop",
+                           [VoidOp] = "void",
+                           [ReturnOp] = "return"};
+
+static void print_code_indented(Code* code, int indent) {
+    for (int i = 0; i < cvector_size(code->instructions); i++) {
+        Instruction instruction = code->instructions[i];
+        printf("%*s%4d %-14s %d\n", indent, "", i, op_names[instruction.op],
+               instruction.arg);
+        if (instruction.op == FnOp) {
+            print_code_indented(code->functions[instruction.arg], indent + 4);
+        }
+    }
+}
+
+/**
+ * @brief print a readable listing of the instructions in code, including the
+ * code of any functions it creates.
+ *
+ * @param code
+ */
+void print_code(Code* code) { print_code_indented(code, 0); }
+
+// TESTS
+static Code* compile_string(char* program) {
+    Expression* expr = parse_source(program);
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    return compile(expr, resolve(expr, &env));
+}
+
+void test_compile_call() {
+    Code* code = compile_string("(print \"a\" \"b\")");
+    assert(cvector_size(code->instructions) == 5);
+    assert(code->instructions[0].op == LoadGlobalOp);
+    assert(code->instructions[1].op == ConstOp);
+    assert(code->instructions[2].op == ConstOp);
+    assert(code->instructions[3].op == TailCallOp);
+    assert(code->instructions[3].arg == 2);
+    assert(code->instructions[4].op == ReturnOp);
+    assert(code->max_stack == 3);
+}
+
+void test_compile_binary_ops() {
+    Code* code = compile_string("(== (* 1 2) 3)");
+    assert(cvector_size(code->instructions) == 6);
+    assert(code->instructions[2].op == MulOp);
+    assert(code->instructions[4].op == EqOp);
+    assert(code->max_stack == 3);
+
+    // only calls with two args have an instruction
+    code = compile_string("(- 1)");
+    assert(code->instructions[0].op == LoadGlobalOp);
+    assert(code->instructions[2].op == TailCallOp);
+
+    // calls the typechecker proved get two ints don't check for the builtin
+    Expression* expr = parse_source("(== (* 1 2) 3)");
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    FrameLayout frame = resolve(expr, &env);
+    typecheck(expr);
+    code = compile(expr, frame);
+    assert(code->instructions[2].op == MulIntOp);
+    assert(code->instructions[4].op == EqIntOp);
+    assert(code->max_stack == 2);
+}
+
+void test_compile_if() {
+    Code* code = compile_string("(if true 1 2)");
+    assert(code->instructions[1].op == JumpIfFalseOp);
+    assert(code->instructions[1].arg == 4);
+    assert(code->instructions[3].op == JumpOp);
+    assert(code->instructions[3].arg == 5);
+}
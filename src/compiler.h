@@ -0,0 +1,91 @@
+#ifndef SPORK_COMPILER_H_
+#define SPORK_COMPILER_H_
+#include "../lib/cvector/cvector.h"
+#include "interpreter.h"
+#include "parser.h"
+
+/**
+ * @brief the instruction set of the spork VM. Every instruction operates on
+ * the VM's value stack, and takes at most one integer argument.
+ */
+typedef enum OpCode {
+    ConstOp,        // push constants[arg]
+    LoadGlobalOp,   // push global arg
+    StoreGlobalOp,  // pop a value into global arg
+    LoadLocalOp,    // push slot arg of the current frame
+    StoreLocalOp,   // pop a value into slot arg of the current frame
+    LoadCaptureOp,  // push capture arg of the current function
+    FnOp,           // push a function built from functions[arg]
+    CallOp,         // call the function below the top arg values
+    TailCallOp,     // call like CallOp, reusing the frame of the caller
+    ScratchTupleOp, // call like CallOp, see ScratchTupleOp in vm.c
+    ParOp,          // call the top arg fns in parallel, push a tuple of results
+    SpawnOp,        // replace the fn on top with a future of what it returns
+    AddOp,          // call global arg on the top 2 values, see BinaryOp
+    SubOp,
+    MulOp,
+    DivOp,
+    EqOp,
+    AddIntOp,       // the builtin on the top 2 values, which are ints
+    SubIntOp,
+    MulIntOp,
+    DivIntOp,
+    EqIntOp,
+    JumpOp,         // continue at instruction arg
+    JumpIfFalseOp,  // pop a bool, continue at instruction arg if it's false
+    PopOp,          // discard the top of the stack
+    VoidOp,         // push a void value
+    ReturnOp        // return the top of the stack to the caller
+} OpCode;
+
+struct VM;
+
+/**
+ * @brief machine code the JIT compiled a Code to, see jit.h
+ */
+typedef int (*NativeFn)(struct VM* vm, Val* locals, Val* sp, Fn* fn);
+
+/**
+ * @brief the C function a Code was compiled to ahead of time, see aot.h
+ */
+typedef Val (*AotFn)(struct VM* vm, Val* locals, Fn* fn);
+
+typedef struct Instruction {
+    OpCode op;
+    int arg;
+} Instruction;
+
+/**
+ * @brief the compiled form of a spork function (or of the whole program, which
+ * is compiled as a function with no params). A call to it needs a frame with
+ * frame.size slots, the first of which hold its params, and room for max_stack
+ * values above them. Creating it as a function copies frame.captures out of
+ * the frame it is created in. stack_depth is only used while compiling. calls
+ * counts the calls to it until it is hot enough to JIT compile into native.
+ * Programs compiled to C run aot instead of any instructions. Each fn created
+ * from a memo Code remembers the results of its calls (see memo.h).
+ */
+typedef struct Code {
+    cvector_vector_type(Instruction) instructions;
+    cvector_vector_type(Val) constants;
+    cvector_vector_type(Code*) functions;
+    cvector_vector_type(Symbol) params;
+    Expression* body;
+    FrameLayout frame;
+    int max_stack;
+    int stack_depth;
+    int calls;
+    NativeFn native;
+    AotFn aot;
+    bool memo;
+} Code;
+
+int stack_effect(OpCode op, int arg);
+Code* compile(Expression* expr, FrameLayout frame);
+void print_code(Code* code);
+
+// TESTS
+void test_compile_call();
+void test_compile_if();
+void test_compile_binary_ops();
+#endif
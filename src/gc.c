@@ -0,0 +1,394 @@
+#include "gc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../lib/cvector/cvector.h"
+#include "builtins.h"
+#include "interpreter.h"
+#include "memo.h"
+#include "parser.h"
+#include "utils.h"
+
+// the heap may grow to this many times what survived the last collection
+// before it is collected again
+#define HEAP_GROWTH_FACTOR 2
+#define MIN_COLLECTION_BYTES (1024 * 1024)
+
+typedef struct RootSet {
+    RootMarker marker;
+    void* roots;
+} RootSet;
+
+_Atomic bool gc_pending = false;
+
+/*
+ * Once other threads run spork code too (see par.h), the heap is shared
+ * between them, and lock guards it. Collections stop the world: a thread that
+ * reaches a safepoint while a collection is pending parks there, and the last
+ * thread to park collects for everyone. Threads that wait for something
+ * without touching any values are parked for as long as they wait, see
+ * gc_block.
+ */
+static bool threaded = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collected = PTHREAD_COND_INITIALIZER;
+// the threads running spork code, and how many of them are parked
+static int mutators = 1;
+static int parked = 0;
+
+static Obj* objects = NULL;
+static cvector_vector_type(Obj*) gray = NULL;
+static cvector_vector_type(Val) pinned = NULL;
+static cvector_vector_type(RootSet) root_sets = NULL;
+static GcStats stats = {.next_collection = MIN_COLLECTION_BYTES};
+
+static size_t obj_size(Obj* obj) {
+    switch (obj->kind) {
+        case StringObj:
+            return sizeof(String);
+        case IntObj:
+            return sizeof(BoxedInt);
+        case BigIntObj:
+            return sizeof(BigInt) + sizeof(uint32_t) * ((BigInt*)obj)->size;
+        case TupleObj:
+            return sizeof(Tuple) + sizeof(Val) * ((Tuple*)obj)->size;
+        case FnObj:
+            return sizeof(Fn) + sizeof(Val) * ((Fn*)obj)->size;
+        case FutureObj:
+            return sizeof(Future);
+    }
+    abort();
+}
+
+static void acquire() {
+    if (threaded) {
+        pthread_mutex_lock(&lock);
+    }
+}
+
+static void release() {
+    if (threaded) {
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/**
+ * @brief allocate an object on the heap. This never collects, since whoever
+ * is allocating may be holding values the collector can't see. It only asks
+ * for a collection at the next safepoint, where every live value is reachable
+ * from a root.
+ *
+ * @param kind
+ * @param size the size of the whole object, including its header
+ * @return Obj*
+ */
+Obj* gc_alloc(ObjKind kind, size_t size) {
+    Obj* obj = malloc(size);
+    if (obj == NULL) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    acquire();
+    *obj = (Obj){.kind = kind, .marked = false, .next = objects};
+    objects = obj;
+    stats.bytes_allocated += size;
+    stats.objects_allocated++;
+    stats.total_bytes_allocated += size;
+    stats.total_objects_allocated++;
+    if (stats.bytes_allocated >= stats.next_collection) {
+        gc_pending = true;
+    }
+    release();
+    return obj;
+}
+
+/**
+ * @brief keep val alive for as long as the program runs, e.g. because it is a
+ * constant in compiled code.
+ *
+ * @param val
+ */
+void gc_pin(Val val) {
+    if (is_obj(val)) {
+        acquire();
+        cvector_push_back(pinned, val);
+        release();
+    }
+}
+
+/**
+ * @brief register a set of roots. Every collection calls marker with roots
+ * until the set is removed again.
+ *
+ * @param marker
+ * @param roots
+ */
+void gc_add_roots(RootMarker marker, void* roots) {
+    acquire();
+    cvector_push_back(root_sets, ((RootSet){.marker = marker, .roots = roots}));
+    release();
+}
+
+void gc_remove_roots(void* roots) {
+    acquire();
+    for (int i = 0; i < cvector_size(root_sets); i++) {
+        if (root_sets[i].roots == roots) {
+            cvector_erase(root_sets, i);
+            break;
+        }
+    }
+    release();
+}
+
+void gc_mark_obj(Obj* obj) {
+    if (obj == NULL || obj->marked) {
+        return;
+    }
+    obj->marked = true;
+    cvector_push_back(gray, obj);
+}
+
+void gc_mark_val(Val val) {
+    if (is_obj(val)) {
+        gc_mark_obj(as_obj(val));
+    }
+}
+
+/**
+ * @brief mark everything obj points to. Marking goes through the gray stack
+ * instead of recursing, so long chains of objects can't overflow the C stack.
+ */
+static void blacken(Obj* obj) {
+    switch (obj->kind) {
+        case StringObj:
+        case IntObj:
+        case BigIntObj:
+            break;
+        case TupleObj: {
+            Tuple* tuple = (Tuple*)obj;
+            for (int i = 0; i < tuple->size; i++) {
+                gc_mark_val(tuple->values[i]);
+            }
+            break;
+        }
+        case FnObj: {
+            Fn* fn = (Fn*)obj;
+            for (int i = 0; i < fn->size; i++) {
+                gc_mark_val(fn->captures[i]);
+            }
+            if (fn->memo != NULL) {
+                mark_memo(fn->memo);
+            }
+            break;
+        }
+        case FutureObj:
+            gc_mark_val(((Future*)obj)->fn);
+            gc_mark_val(((Future*)obj)->value);
+            break;
+    }
+}
+
+static void mark_roots() {
+    for (int i = 0; i < cvector_size(pinned); i++) {
+        gc_mark_val(pinned[i]);
+    }
+    for (int i = 0; i < cvector_size(root_sets); i++) {
+        root_sets[i].marker(root_sets[i].roots);
+    }
+    while (!cvector_empty(gray)) {
+        Obj* obj = gray[cvector_size(gray) - 1];
+        cvector_pop_back(gray);
+        blacken(obj);
+    }
+}
+
+static void sweep() {
+    Obj** link = &objects;
+    while (*link != NULL) {
+        Obj* obj = *link;
+        if (obj->marked) {
+            obj->marked = false;
+            link = &obj->next;
+        } else {
+            *link = obj->next;
+            size_t size = obj_size(obj);
+            stats.bytes_allocated -= size;
+            stats.objects_allocated--;
+            stats.bytes_freed += size;
+            if (obj->kind == FnObj && ((Fn*)obj)->memo != NULL) {
+                free_memo(((Fn*)obj)->memo);
+            }
+            free(obj);
+        }
+    }
+}
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static void collect() {
+    double start = now_ms();
+    mark_roots();
+    sweep();
+    stats.next_collection = stats.bytes_allocated * HEAP_GROWTH_FACTOR;
+    if (stats.next_collection < MIN_COLLECTION_BYTES) {
+        stats.next_collection = MIN_COLLECTION_BYTES;
+    }
+    gc_pending = false;
+
+    double pause = now_ms() - start;
+    stats.collections++;
+    stats.total_pause_ms += pause;
+    if (pause > stats.max_pause_ms) {
+        stats.max_pause_ms = pause;
+    }
+}
+
+/**
+ * @brief free every object that isn't reachable from a pinned value or a
+ * registered root set. Only call this at a safepoint while no other thread
+ * runs spork code: any object that is only referenced from C locals will be
+ * freed.
+ */
+void gc_collect() {
+    acquire();
+    collect();
+    release();
+}
+
+/// @brief collect if every mutator is parked. The lock must be held.
+static void collect_if_stopped() {
+    if (gc_pending && parked == mutators) {
+        collect();
+        pthread_cond_broadcast(&collected);
+    }
+}
+
+/**
+ * @brief collect if a collection is pending. Every live value the calling
+ * thread has must be reachable from a root. If other threads run spork code,
+ * this waits for all of them to park, and whichever parks last collects.
+ */
+void gc_safepoint() {
+    if (!gc_pending) {
+        return;
+    }
+    if (!threaded) {
+        collect();
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    parked++;
+    collect_if_stopped();
+    while (gc_pending) {
+        pthread_cond_wait(&collected, &lock);
+    }
+    parked--;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief count the calling thread as one more that runs spork code, from now
+ * on. The heap is locked from the first time this is called.
+ */
+void gc_add_mutator() {
+    threaded = true;
+    pthread_mutex_lock(&lock);
+    mutators++;
+    pthread_mutex_unlock(&lock);
+}
+
+void gc_remove_mutator() {
+    pthread_mutex_lock(&lock);
+    mutators--;
+    collect_if_stopped();
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief park the calling thread until gc_unblock, so collections don't wait
+ * for it. In between it must not touch any values, and every live value it
+ * has must be reachable from a root.
+ */
+void gc_block() {
+    if (!threaded) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    parked++;
+    collect_if_stopped();
+    pthread_mutex_unlock(&lock);
+}
+
+void gc_unblock() {
+    if (!threaded) {
+        return;
+    }
+    // a collection in progress holds the lock until it's done
+    pthread_mutex_lock(&lock);
+    parked--;
+    pthread_mutex_unlock(&lock);
+}
+
+GcStats gc_stats() { return stats; }
+
+void print_gc_stats() {
+    fprintf(stderr,
+            "gc: %zu collections, %.3f ms total pause, %.3f ms max pause\n"
+            "gc: %zu objects (%zu bytes) allocated, %zu bytes freed\n"
+            "gc: %zu objects (%zu bytes) live\n",
+            stats.collections, stats.total_pause_ms, stats.max_pause_ms,
+            stats.total_objects_allocated, stats.total_bytes_allocated,
+            stats.bytes_freed, stats.objects_allocated, stats.bytes_allocated);
+}
+
+// TESTS
+static void mark_tuple(void* roots) { gc_mark_val(*(Val*)roots); }
+
+void test_gc_frees_garbage() {
+    gc_collect();
+    GcStats before = gc_stats();
+    for (int i = 0; i < 100; i++) {
+        new_tuple(4);
+    }
+    assert(gc_stats().objects_allocated == before.objects_allocated + 100);
+    gc_collect();
+    assert(gc_stats().objects_allocated == before.objects_allocated);
+    assert(gc_stats().bytes_allocated == before.bytes_allocated);
+}
+
+void test_gc_keeps_roots() {
+    Val tuple = new_tuple(2);
+    as_tuple(tuple)->values[0] = int_val(1l << 60);
+    as_tuple(tuple)->values[1] = new_fn(NULL, 1);
+    as_fn(as_tuple(tuple)->values[1])->captures[0] = int_val(-(1l << 60));
+    gc_add_roots(mark_tuple, &tuple);
+    gc_collect();
+    gc_collect();
+    assert(as_int(as_tuple(tuple)->values[0]) == 1l << 60);
+    Fn* fn = as_fn(as_tuple(tuple)->values[1]);
+    assert(as_int(fn->captures[0]) == -(1l << 60));
+    gc_remove_roots(&tuple);
+}
+
+void test_gc_bounds_memory() {
+    char program[] =
+        "(let loop (fn (i)"
+        "    (if (== i 0) 0"
+        "        (let f (fn (x) (+ x i)));"
+        "        (loop (- i 1)))));"
+        "(loop 200000)";
+    size_t collections = gc_stats().collections;
+    assert(as_int(run_source(program)) == 0);
+    // every iteration leaves a fn behind, which is far more than
+    // the heap is allowed to grow to before it is collected
+    assert(gc_stats().collections > collections);
+    gc_collect();
+    assert(gc_stats().bytes_allocated < MIN_COLLECTION_BYTES);
+}
@@ -0,0 +1,51 @@
+#ifndef SPORK_GC_H_
+#define SPORK_GC_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "value.h"
+
+/**
+ * @brief marks everything a root set keeps alive, by calling gc_mark_val or
+ * gc_mark_obj on each of its values.
+ */
+typedef void (*RootMarker)(void* roots);
+
+typedef struct GcStats {
+    size_t bytes_allocated;
+    size_t objects_allocated;
+    size_t total_bytes_allocated;
+    size_t total_objects_allocated;
+    size_t bytes_freed;
+    size_t collections;
+    size_t next_collection;
+    double total_pause_ms;
+    double max_pause_ms;
+} GcStats;
+
+/**
+ * @brief set once enough has been allocated since the last collection that
+ * the next safepoint should collect.
+ */
+extern _Atomic bool gc_pending;
+
+Obj* gc_alloc(ObjKind kind, size_t size);
+void gc_pin(Val val);
+void gc_add_roots(RootMarker marker, void* roots);
+void gc_remove_roots(void* roots);
+void gc_mark_val(Val val);
+void gc_mark_obj(Obj* obj);
+void gc_collect();
+void gc_safepoint();
+void gc_add_mutator();
+void gc_remove_mutator();
+void gc_block();
+void gc_unblock();
+GcStats gc_stats();
+void print_gc_stats();
+
+// TESTS
+void test_gc_frees_garbage();
+void test_gc_keeps_roots();
+void test_gc_bounds_memory();
+#endif
@@ -0,0 +1,191 @@
+#include "hamt.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HAMT_MASK ((1u << HAMT_BITS) - 1)
+
+// the shift at which a symbol's hash has no bits left to tell it apart
+#define HASH_BITS 64
+
+static Hamt* new_node(uint32_t bitmap, int size, bool collision) {
+    Hamt* node = malloc(sizeof(Hamt) + sizeof(HamtEntry) * size);
+    node->bitmap = bitmap;
+    node->size = size;
+    node->collision = collision;
+    return node;
+}
+
+static uint32_t bit_at(Symbol key, int shift) {
+    return 1u << ((key->hash >> shift) & HAMT_MASK);
+}
+
+/// @brief the index in node of the entry for bit
+static int index_of(Hamt* node, uint32_t bit) {
+    return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+static HamtEntry leaf(Symbol key, void* value) {
+    return (HamtEntry){.key = key, .value = value};
+}
+
+/**
+ * @brief a node holding the two entries a and b, whose keys are different
+ * but have the same hash below shift.
+ */
+static Hamt* merge(HamtEntry a, HamtEntry b, int shift) {
+    if (shift >= HASH_BITS) {
+        Hamt* node = new_node(0, 2, true);
+        node->entries[0] = a;
+        node->entries[1] = b;
+        return node;
+    }
+    uint32_t bit_a = bit_at(a.key, shift);
+    uint32_t bit_b = bit_at(b.key, shift);
+    if (bit_a == bit_b) {
+        Hamt* node = new_node(bit_a, 1, false);
+        node->entries[0] =
+            (HamtEntry){.key = NULL, .child = merge(a, b, shift + HAMT_BITS)};
+        return node;
+    }
+    Hamt* node = new_node(bit_a | bit_b, 2, false);
+    node->entries[bit_a < bit_b ? 0 : 1] = a;
+    node->entries[bit_a < bit_b ? 1 : 0] = b;
+    return node;
+}
+
+/// @brief a copy of node, with room for extra more entries
+static Hamt* copy_node(Hamt* node, int extra) {
+    Hamt* copy = new_node(node->bitmap, node->size + extra, node->collision);
+    memcpy(copy->entries, node->entries, sizeof(HamtEntry) * node->size);
+    return copy;
+}
+
+static Hamt* set_in_collision(Hamt* node, Symbol key, void* value) {
+    for (int i = 0; i < node->size; i++) {
+        if (node->entries[i].key == key) {
+            Hamt* copy = copy_node(node, 0);
+            copy->entries[i].value = value;
+            return copy;
+        }
+    }
+    Hamt* copy = copy_node(node, 1);
+    copy->entries[node->size] = leaf(key, value);
+    return copy;
+}
+
+static Hamt* set(Hamt* node, Symbol key, void* value, int shift) {
+    if (node->collision) {
+        return set_in_collision(node, key, value);
+    }
+    uint32_t bit = bit_at(key, shift);
+    int index = index_of(node, bit);
+    if (!(node->bitmap & bit)) {
+        Hamt* copy = new_node(node->bitmap | bit, node->size + 1, false);
+        memcpy(copy->entries, node->entries, sizeof(HamtEntry) * index);
+        copy->entries[index] = leaf(key, value);
+        memcpy(copy->entries + index + 1, node->entries + index,
+               sizeof(HamtEntry) * (node->size - index));
+        return copy;
+    }
+    HamtEntry entry = node->entries[index];
+    Hamt* copy = copy_node(node, 0);
+    if (entry.key == NULL) {
+        copy->entries[index].child =
+            set(entry.child, key, value, shift + HAMT_BITS);
+    } else if (entry.key == key) {
+        copy->entries[index].value = value;
+    } else {
+        copy->entries[index] = (HamtEntry){
+            .key = NULL,
+            .child = merge(entry, leaf(key, value), shift + HAMT_BITS)};
+    }
+    return copy;
+}
+
+/**
+ * @brief map with key bound to value. map itself is left as it was, and
+ * shares all but the O(log n) nodes on the way to key with the result.
+ *
+ * @param map
+ * @param key
+ * @param value
+ * @return Hamt*
+ */
+Hamt* hamt_set(Hamt* map, Symbol key, void* value) {
+    if (map == NULL) {
+        Hamt* node = new_node(bit_at(key, 0), 1, false);
+        node->entries[0] = leaf(key, value);
+        return node;
+    }
+    return set(map, key, value, 0);
+}
+
+/**
+ * @brief the value key is bound to in map, or NULL if it isn't
+ */
+void* hamt_get(Hamt* map, Symbol key) {
+    for (int shift = 0; map != NULL; shift += HAMT_BITS) {
+        if (map->collision) {
+            for (int i = 0; i < map->size; i++) {
+                if (map->entries[i].key == key) {
+                    return map->entries[i].value;
+                }
+            }
+            return NULL;
+        }
+        uint32_t bit = bit_at(key, shift);
+        if (!(map->bitmap & bit)) {
+            return NULL;
+        }
+        HamtEntry* entry = &map->entries[index_of(map, bit)];
+        if (entry->key != NULL) {
+            return entry->key == key ? entry->value : NULL;
+        }
+        map = entry->child;
+    }
+    return NULL;
+}
+
+// TESTS
+void test_hamt_persistent() {
+    char name[16];
+    Symbol symbols[1000];
+    Hamt* maps[1001] = {NULL};
+    for (int i = 0; i < 1000; i++) {
+        sprintf(name, "s%d", i);
+        symbols[i] = intern(name);
+        maps[i + 1] = hamt_set(maps[i], symbols[i], &symbols[i]);
+    }
+    // every version only has the symbols set before it was made
+    for (int version = 0; version <= 1000; version += 100) {
+        for (int i = 0; i < 1000; i++) {
+            void* value = hamt_get(maps[version], symbols[i]);
+            assert(value == (i < version ? &symbols[i] : NULL));
+        }
+    }
+    Hamt* rebound = hamt_set(maps[1000], symbols[5], NULL);
+    assert(hamt_get(rebound, symbols[5]) == NULL);
+    assert(hamt_get(maps[1000], symbols[5]) == &symbols[5]);
+    assert(hamt_get(rebound, symbols[6]) == &symbols[6]);
+}
+
+void test_hamt_collisions() {
+    // symbols aren't compared by their hashes, so these can share one
+    SymbolEntry entries[3] = {{.name = "a", .hash = 42},
+                              {.name = "b", .hash = 42},
+                              {.name = "c", .hash = 42 | (1ul << 63)}};
+    Hamt* map = NULL;
+    for (int i = 0; i < 3; i++) {
+        map = hamt_set(map, &entries[i], &entries[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        assert(hamt_get(map, &entries[i]) == &entries[i]);
+    }
+    Hamt* rebound = hamt_set(map, &entries[1], NULL);
+    assert(hamt_get(rebound, &entries[0]) == &entries[0]);
+    assert(hamt_get(rebound, &entries[1]) == NULL);
+    assert(hamt_get(map, &entries[1]) == &entries[1]);
+}
@@ -0,0 +1,45 @@
+#ifndef SPORK_HAMT_H_
+#define SPORK_HAMT_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "symbol.h"
+
+// how many bits of a symbol's hash pick the entry at each level of the trie
+#define HAMT_BITS 5
+
+typedef struct Hamt Hamt;
+
+/**
+ * @brief an entry of a Hamt node: a key and its value, or (when key is NULL)
+ * the node for the keys whose hashes continue differently.
+ */
+typedef struct HamtEntry {
+    Symbol key;
+    union {
+        void* value;
+        Hamt* child;
+    };
+} HamtEntry;
+
+/**
+ * @brief a persistent map from symbols to pointers, as a hash array mapped
+ * trie. NULL is the empty map. Maps are never changed: setting a key makes a
+ * new map, which shares everything but the path to the key with the old one.
+ * A node only has entries for the bits set in bitmap. Symbols whose hashes are
+ * all the same end up in a collision node, which is searched linearly.
+ */
+struct Hamt {
+    uint32_t bitmap;
+    int size;
+    bool collision;
+    HamtEntry entries[];
+};
+
+Hamt* hamt_set(Hamt* map, Symbol key, void* value);
+void* hamt_get(Hamt* map, Symbol key);
+
+// TESTS
+void test_hamt_persistent();
+void test_hamt_collisions();
+#endif
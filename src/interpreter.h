@@ -2,33 +2,7 @@
 #define SPORK_INTERPRETER_H_
 #include "../lib/cvector/cvector.h"
 #include "parser.h"
-
-typedef struct Val Val;
-
-typedef struct Tuple {
-    cvector_vector_type(Val) values;
-} Tuple;
-
-typedef struct Fn {
-    cvector_vector_type(Symbol) args;
-    Expression* body;
-} Fn;
-
-
-typedef Val (*BuiltinFn)(Tuple tup);
-
-typedef enum ValKind { LiteralVal, TupleVal, FnVal, BuiltinFnVal, VoidVal } ValKind;
-typedef union ValType {
-    Literal lit;
-    Tuple tup;
-    BuiltinFn bfn;
-    Fn fn;
-} ValType;
-
-typedef struct Val {
-    ValKind kind;
-    ValType type;
-} Val;
+#include "value.h"
 
 typedef struct LexicalBinding {
     Symbol symbol;
@@ -36,4 +10,4 @@ typedef struct LexicalBinding {
 } LexicalBinding;
 
 Val eval(Expression* expr, cvector_vector_type(LexicalBinding) *env);
-#endif
\ No newline at end of file
+#endif
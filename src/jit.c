@@ -0,0 +1,623 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../lib/cvector/cvector.h"
+#include "builtins.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "utils.h"
+
+bool jit_enabled = false;
+
+#ifdef JIT_SUPPORTED
+/*
+ * A template JIT for x86-64. Every instruction of a Code is translated to a
+ * fixed sequence of machine code that does what the interpreter does, on the
+ * same stack and frame. That way native code can hand the call back to the
+ * interpreter at any instruction it doesn't handle itself (an operand that
+ * isn't a small int, a call that doesn't return in native code, ...), and the
+ * interpreter carries on as if it had run the call all along.
+ *
+ * While native code runs, these registers hold the interpreter's state. They
+ * are all callee saved, so they survive calls into C.
+ */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3  // the top of the stack, like VM.sp
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R12 12  // the locals of the call
+#define R13 13  // the VM
+#define R14 14  // the VM's globals
+#define R15 15  // the fn being called, for its captures
+
+// the size of a Val, as a displacement
+#define SLOT ((int)sizeof(Val))
+
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+
+/**
+ * @brief a rel32 at offset `at` of the machine code, which jumps to the code
+ * of instruction `target`, or to the code that hands instruction `target`
+ * back to the interpreter.
+ */
+typedef struct Patch {
+    int at;
+    int target;
+} Patch;
+
+typedef struct Assembler {
+    cvector_vector_type(uint8_t) bytes;
+    cvector_vector_type(int) labels;
+    cvector_vector_type(Patch) jumps;
+    cvector_vector_type(Patch) bails;
+    cvector_vector_type(int) calls;
+} Assembler;
+
+static void byte(Assembler* as, uint8_t b) { cvector_push_back(as->bytes, b); }
+
+static void imm32(Assembler* as, int32_t imm) {
+    for (int i = 0; i < 4; i++) {
+        byte(as, (imm >> (8 * i)) & 0xff);
+    }
+}
+
+static void imm64(Assembler* as, uint64_t imm) {
+    for (int i = 0; i < 8; i++) {
+        byte(as, (imm >> (8 * i)) & 0xff);
+    }
+}
+
+static void rex(Assembler* as, int reg, int rm) {
+    byte(as, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+/// @brief `opcode reg, rm` between two registers, e.g. 0x89 is mov rm, reg
+static void op_reg(Assembler* as, uint8_t opcode, int reg, int rm) {
+    rex(as, reg, rm);
+    byte(as, opcode);
+    byte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/// @brief `opcode reg, [base + disp]`, e.g. 0x8b is mov reg, [base + disp]
+static void op_mem(Assembler* as, uint8_t opcode, int reg, int base,
+                   int32_t disp) {
+    rex(as, reg, base);
+    byte(as, opcode);
+    byte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        byte(as, 0x24);
+    }
+    imm32(as, disp);
+}
+
+/// @brief `op rm, imm`, where ext picks the op: 0 add, 1 or, 5 sub, 7 cmp
+static void op_imm(Assembler* as, int ext, int rm, int32_t imm) {
+    rex(as, 0, rm);
+    byte(as, 0x81);
+    byte(as, 0xc0 | (ext << 3) | (rm & 7));
+    imm32(as, imm);
+}
+
+/// @brief shift rm by n, where ext picks the shift: 4 shl, 5 shr, 7 sar
+static void shift(Assembler* as, int ext, int rm, int n) {
+    rex(as, 0, rm);
+    byte(as, 0xc1);
+    byte(as, 0xc0 | (ext << 3) | (rm & 7));
+    byte(as, n);
+}
+
+static void mov_imm(Assembler* as, int reg, uint64_t imm) {
+    rex(as, 0, reg);
+    byte(as, 0xb8 + (reg & 7));
+    imm64(as, imm);
+}
+
+static void push_reg(Assembler* as, int reg) {
+    if (reg >= 8) {
+        byte(as, 0x41);
+    }
+    byte(as, 0x50 + (reg & 7));
+}
+
+static void pop_reg(Assembler* as, int reg) {
+    if (reg >= 8) {
+        byte(as, 0x41);
+    }
+    byte(as, 0x58 + (reg & 7));
+}
+
+static void call_abs(Assembler* as, void* fn) {
+    mov_imm(as, RAX, (uintptr_t)fn);
+    byte(as, 0xff);
+    byte(as, 0xd0);
+}
+
+static void jump_to(Assembler* as, int instruction) {
+    byte(as, 0xe9);
+    cvector_push_back(as->jumps, ((Patch){cvector_size(as->bytes), instruction}));
+    imm32(as, 0);
+}
+
+static void jump_if_to(Assembler* as, int cc, int instruction) {
+    byte(as, 0x0f);
+    byte(as, 0x80 | cc);
+    cvector_push_back(as->jumps, ((Patch){cvector_size(as->bytes), instruction}));
+    imm32(as, 0);
+}
+
+/// @brief jump to the code that hands instruction back to the interpreter
+static void bail_if(Assembler* as, int cc, int instruction) {
+    byte(as, 0x0f);
+    byte(as, 0x80 | cc);
+    cvector_push_back(as->bails, ((Patch){cvector_size(as->bytes), instruction}));
+    imm32(as, 0);
+}
+
+static void bail(Assembler* as, int instruction) {
+    byte(as, 0xe9);
+    cvector_push_back(as->bails, ((Patch){cvector_size(as->bytes), instruction}));
+    imm32(as, 0);
+}
+
+static void save_sp(Assembler* as) {
+    op_mem(as, 0x89, RBX, R13, offsetof(VM, sp));
+}
+
+static void prologue(Assembler* as) {
+    push_reg(as, RBP);
+    op_reg(as, 0x89, RSP, RBP);
+    push_reg(as, RBX);
+    push_reg(as, R12);
+    push_reg(as, R13);
+    push_reg(as, R14);
+    push_reg(as, R15);
+    // keep the stack 16 byte aligned for calls into C
+    op_imm(as, 5, RSP, 8);
+    op_reg(as, 0x89, RDI, R13);
+    op_reg(as, 0x89, RSI, R12);
+    op_reg(as, 0x89, RDX, RBX);
+    op_reg(as, 0x89, RCX, R15);
+    op_mem(as, 0x8b, R14, R13, offsetof(VM, globals));
+    op_mem(as, 0x8b, R14, R14, 0);
+}
+
+/// @brief return result from the native code
+static void epilogue(Assembler* as, int result) {
+    byte(as, 0xb8);
+    imm32(as, result);
+    op_imm(as, 0, RSP, 8);
+    pop_reg(as, R15);
+    pop_reg(as, R14);
+    pop_reg(as, R13);
+    pop_reg(as, R12);
+    pop_reg(as, RBX);
+    pop_reg(as, RBP);
+    byte(as, 0xc3);
+}
+
+static void push_rax(Assembler* as) {
+    op_mem(as, 0x89, RAX, RBX, 0);
+    op_imm(as, 0, RBX, SLOT);
+}
+
+static void pop_rax(Assembler* as) {
+    op_mem(as, 0x8b, RAX, RBX, -SLOT);
+    op_imm(as, 5, RBX, SLOT);
+}
+
+static int32_t global_offset(int global) {
+    return global * sizeof(LexicalBinding) +
+           offsetof(LexicalBinding, boundValue);
+}
+
+/// @brief bail out to the interpreter unless reg holds a small int
+static void check_small_int(Assembler* as, int reg, int instruction) {
+    op_reg(as, 0x89, reg, RCX);
+    shift(as, 5, RCX, 48);
+    op_imm(as, 7, RCX, TAG_BITS(IntTag) >> 48);
+    bail_if(as, CC_NE, instruction);
+}
+
+/// @brief sign extend the 48 bit payload of the small int in reg
+static void unbox_int(Assembler* as, int reg) {
+    shift(as, 4, reg, 16);
+    shift(as, 7, reg, 16);
+}
+
+/**
+ * @brief the code for AddOp and friends. Like the interpreter, it only
+ * handles two small ints passed to the builtin the global is still bound to,
+ * whose result is small too. Anything else is left to the interpreter, which
+ * finds the stack untouched. AddIntOp and friends are compiled like the op
+ * they specialize, with a NULL builtin since there is no callee to check.
+ */
+static void compile_binary_op(Assembler* as, Instruction instruction,
+                              int index, BuiltinFn builtin) {
+    if (builtin != NULL) {
+        op_mem(as, 0x8b, RAX, R14, global_offset(instruction.arg));
+        mov_imm(as, RCX, builtin_val(builtin));
+        op_reg(as, 0x39, RCX, RAX);
+        bail_if(as, CC_NE, index);
+    }
+    op_mem(as, 0x8b, RAX, RBX, -2 * SLOT);
+    op_mem(as, 0x8b, RDX, RBX, -SLOT);
+    check_small_int(as, RAX, index);
+    check_small_int(as, RDX, index);
+
+    if (instruction.op == EqOp) {
+        // mov leaves the flags alone, so the bool is FALSE_VAL with the
+        // result of the comparison or'd into its lowest bit
+        op_reg(as, 0x39, RDX, RAX);
+        mov_imm(as, RAX, FALSE_VAL);
+        byte(as, 0x0f), byte(as, 0x94), byte(as, 0xc1);  // sete cl
+        byte(as, 0x0f), byte(as, 0xb6), byte(as, 0xc9);  // movzx ecx, cl
+        op_reg(as, 0x09, RCX, RAX);
+    } else {
+        unbox_int(as, RAX);
+        unbox_int(as, RDX);
+        switch (instruction.op) {
+            case AddOp:
+                op_reg(as, 0x01, RDX, RAX);
+                break;
+            case SubOp:
+                op_reg(as, 0x29, RDX, RAX);
+                break;
+            case MulOp:
+                rex(as, RAX, RDX);
+                byte(as, 0x0f), byte(as, 0xaf), byte(as, 0xc2);  // imul rax, rdx
+                bail_if(as, CC_O, index);
+                break;
+            case DivOp:
+                op_reg(as, 0x89, RDX, RCX);
+                op_reg(as, 0x85, RCX, RCX);
+                bail_if(as, CC_E, index);
+                byte(as, 0x48), byte(as, 0x99);  // cqo
+                rex(as, 0, RCX);
+                byte(as, 0xf7), byte(as, 0xf9);  // idiv rcx
+                break;
+            default:
+                abort();
+        }
+        // the result has to fit back into a small int
+        op_reg(as, 0x89, RAX, RCX);
+        unbox_int(as, RCX);
+        op_reg(as, 0x39, RAX, RCX);
+        bail_if(as, CC_NE, index);
+        mov_imm(as, RCX, PAYLOAD_MASK);
+        op_reg(as, 0x21, RCX, RAX);
+        mov_imm(as, RCX, TAG_BITS(IntTag));
+        op_reg(as, 0x09, RCX, RAX);
+    }
+    op_mem(as, 0x89, RAX, RBX, -2 * SLOT);
+    op_imm(as, 5, RBX, SLOT);
+}
+
+/**
+ * @brief the code for a call that isn't in tail position. vm_jit_call makes
+ * the call, running the called fn in native code if it can. If the call
+ * didn't return, the interpreter has to finish it and the rest of this call.
+ */
+static void compile_call(Assembler* as, Instruction instruction, int index) {
+    save_sp(as);
+    op_reg(as, 0x89, R13, RDI);
+    mov_imm(as, RSI, instruction.arg);
+    mov_imm(as, RDX, index + 1);
+    call_abs(as, vm_jit_call);
+    op_reg(as, 0x85, RAX, RAX);
+    byte(as, 0x0f), byte(as, 0x84);  // jz to the JIT_CALLED exit
+    cvector_push_back(as->calls, cvector_size(as->bytes));
+    imm32(as, 0);
+    // the stack may have moved during the call
+    op_reg(as, 0x89, RAX, R12);
+    op_mem(as, 0x8b, RBX, R13, offsetof(VM, sp));
+}
+
+/**
+ * @brief the code for a call in tail position. A fn calling itself starts
+ * over in the same frame without leaving native code, any other tail call is
+ * made by the interpreter.
+ */
+static void compile_tail_call(Assembler* as, Code* code,
+                              Instruction instruction, int index) {
+    int argc = instruction.arg;
+    if (argc != cvector_size(code->params)) {
+        bail(as, index);
+        return;
+    }
+    op_mem(as, 0x8b, RAX, RBX, -(argc + 1) * SLOT);
+    mov_imm(as, RCX, TAG_BITS(ObjTag));
+    op_reg(as, 0x09, R15, RCX);
+    op_reg(as, 0x39, RCX, RAX);
+    bail_if(as, CC_NE, index);
+    // calls are safepoints, so collect garbage in the interpreter if needed
+    mov_imm(as, RAX, (uintptr_t)&gc_pending);
+    byte(as, 0x80), byte(as, 0x38), byte(as, 0x00);  // cmp byte [rax], 0
+    bail_if(as, CC_NE, index);
+
+    for (int i = 0; i < argc; i++) {
+        op_mem(as, 0x8b, RAX, RBX, -(argc - i) * SLOT);
+        op_mem(as, 0x89, RAX, R12, i * SLOT);
+    }
+    mov_imm(as, RAX, VOID_VAL);
+    for (int i = argc; i < code->frame.size; i++) {
+        op_mem(as, 0x89, RAX, R12, i * SLOT);
+    }
+    op_mem(as, 0x8d, RBX, R12, code->frame.size * SLOT);
+    jump_to(as, 0);
+}
+
+static bool compile_instruction(Assembler* as, Code* code, int index) {
+    Instruction instruction = code->instructions[index];
+    switch (instruction.op) {
+        case ConstOp:
+            mov_imm(as, RAX, code->constants[instruction.arg]);
+            push_rax(as);
+            break;
+        case LoadGlobalOp:
+            op_mem(as, 0x8b, RAX, R14, global_offset(instruction.arg));
+            push_rax(as);
+            break;
+        case StoreGlobalOp:
+            pop_rax(as);
+            op_mem(as, 0x89, RAX, R14, global_offset(instruction.arg));
+            break;
+        case LoadLocalOp:
+            op_mem(as, 0x8b, RAX, R12, instruction.arg * SLOT);
+            push_rax(as);
+            break;
+        case StoreLocalOp:
+            pop_rax(as);
+            op_mem(as, 0x89, RAX, R12, instruction.arg * SLOT);
+            break;
+        case LoadCaptureOp:
+            op_mem(as, 0x8b, RAX, R15,
+                   offsetof(Fn, captures) + instruction.arg * SLOT);
+            push_rax(as);
+            break;
+        case FnOp:
+            // creating fns is left to the interpreter
+            return false;
+        case ParOp:
+        case SpawnOp:
+            // so is starting tasks, see par.h and async.h
+            return false;
+        case CallOp:
+        case ScratchTupleOp:
+            // native code makes its tuples on the heap
+            compile_call(as, instruction, index);
+            break;
+        case TailCallOp:
+            compile_tail_call(as, code, instruction, index);
+            break;
+        case AddOp:
+            compile_binary_op(as, instruction, index, builtin_add);
+            break;
+        case SubOp:
+            compile_binary_op(as, instruction, index, builtin_sub);
+            break;
+        case MulOp:
+            compile_binary_op(as, instruction, index, builtin_mul);
+            break;
+        case DivOp:
+            compile_binary_op(as, instruction, index, builtin_div);
+            break;
+        case EqOp:
+            compile_binary_op(as, instruction, index, builtin_eq);
+            break;
+        case AddIntOp:
+            compile_binary_op(as, (Instruction){.op = AddOp}, index, NULL);
+            break;
+        case SubIntOp:
+            compile_binary_op(as, (Instruction){.op = SubOp}, index, NULL);
+            break;
+        case MulIntOp:
+            compile_binary_op(as, (Instruction){.op = MulOp}, index, NULL);
+            break;
+        case DivIntOp:
+            compile_binary_op(as, (Instruction){.op = DivOp}, index, NULL);
+            break;
+        case EqIntOp:
+            compile_binary_op(as, (Instruction){.op = EqOp}, index, NULL);
+            break;
+        case JumpOp:
+            jump_to(as, instruction.arg);
+            break;
+        case JumpIfFalseOp:
+            // a bool is FALSE_VAL, with its lowest bit set if it's true
+            op_mem(as, 0x8b, RAX, RBX, -SLOT);
+            op_reg(as, 0x89, RAX, RCX);
+            op_imm(as, 1, RCX, 1);
+            mov_imm(as, RDX, TRUE_VAL);
+            op_reg(as, 0x39, RDX, RCX);
+            bail_if(as, CC_NE, index);
+            op_imm(as, 5, RBX, SLOT);
+            byte(as, 0xa8), byte(as, 0x01);  // test al, 1
+            jump_if_to(as, CC_E, instruction.arg);
+            break;
+        case PopOp:
+            op_imm(as, 5, RBX, SLOT);
+            break;
+        case VoidOp:
+            mov_imm(as, RAX, VOID_VAL);
+            push_rax(as);
+            break;
+        case ReturnOp:
+            save_sp(as);
+            epilogue(as, JIT_RETURNED);
+            break;
+    }
+    return true;
+}
+
+static void patch(Assembler* as, int at, int target) {
+    int32_t rel = target - (at + 4);
+    memcpy(&as->bytes[at], &rel, sizeof(rel));
+}
+
+/**
+ * @brief emit the exits to the interpreter after the code of the
+ * instructions, and point every jump at its target.
+ */
+static void link_exits(Assembler* as, int instructions) {
+    int exits[instructions];
+    for (int i = 0; i < instructions; i++) {
+        exits[i] = -1;
+    }
+    for (int i = 0; i < cvector_size(as->bails); i++) {
+        int instruction = as->bails[i].target;
+        if (exits[instruction] == -1) {
+            exits[instruction] = cvector_size(as->bytes);
+            save_sp(as);
+            epilogue(as, instruction);
+        }
+        patch(as, as->bails[i].at, exits[instruction]);
+    }
+    // the called fn's frame is on top now, so the VM's sp is already right
+    int called = cvector_size(as->bytes);
+    epilogue(as, JIT_CALLED);
+    for (int i = 0; i < cvector_size(as->calls); i++) {
+        patch(as, as->calls[i], called);
+    }
+    for (int i = 0; i < cvector_size(as->jumps); i++) {
+        patch(as, as->jumps[i].at, as->labels[as->jumps[i].target]);
+    }
+}
+
+static void free_assembler(Assembler* as) {
+    cvector_free(as->bytes);
+    cvector_free(as->labels);
+    cvector_free(as->jumps);
+    cvector_free(as->bails);
+    cvector_free(as->calls);
+}
+
+/**
+ * @brief compile code to native code, and set code->native to it. Code that
+ * creates fns isn't compiled, and keeps running in the interpreter, and so
+ * does memo code, whose results are stored by the interpreter's ReturnOp.
+ *
+ * @param code
+ * @return bool whether code was compiled
+ */
+bool jit_compile(Code* code) {
+    if (code->memo) {
+        return false;
+    }
+    Assembler as = {NULL, NULL, NULL, NULL, NULL};
+    cvector_reserve(as.bytes, 1024);
+    prologue(&as);
+    int instructions = cvector_size(code->instructions);
+    for (int i = 0; i < instructions; i++) {
+        cvector_push_back(as.labels, cvector_size(as.bytes));
+        if (!compile_instruction(&as, code, i)) {
+            free_assembler(&as);
+            return false;
+        }
+    }
+    link_exits(&as, instructions);
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (cvector_size(as.bytes) + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free_assembler(&as);
+        return false;
+    }
+    memcpy(memory, as.bytes, cvector_size(as.bytes));
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        free_assembler(&as);
+        return false;
+    }
+    __atomic_store_n(&code->native, (NativeFn)memory, __ATOMIC_RELEASE);
+    free_assembler(&as);
+    return true;
+}
+#else
+bool jit_compile(Code* code) { return false; }
+#endif
+
+// TESTS
+static Val run_jit(char* program, Code** fn_code) {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    Expression* expr = parse_source(program);
+    Code* code = compile(expr, resolve(expr, &env));
+    jit_enabled = true;
+    VM vm = new_vm(&env);
+    Val val = vm_run(&vm, code);
+    free_vm(&vm);
+    jit_enabled = false;
+    if (fn_code != NULL) {
+        *fn_code = code->functions[0];
+    }
+    return val;
+}
+
+void test_jit_compiles_hot_fns() {
+    Code* fib;
+    Val val = run_jit(
+        "(let fib (fn (n) (if (== n 0) 0 (if (== n 1) 1"
+        "    (+ (fib (- n 1)) (fib (- n 2)))))));"
+        "(fib 20)",
+        &fib);
+    assert(as_int(val) == 6765);
+    assert(fib->native != NULL);
+
+    // a loop in tail position stays in native code
+    Code* count;
+    val = run_jit(
+        "(let count (fn (n acc)"
+        "    (if (== n 0) acc (count (- n 1) (+ acc (* 2 (/ n n)))))));"
+        "(count 1000000 0)",
+        &count);
+    assert(as_int(val) == 2000000);
+    assert(count->native != NULL);
+}
+
+void test_jit_falls_back() {
+    // results too big to be small ints are boxed by the interpreter, and the
+    // call carries on there
+    Val val = run_jit(
+        "(let grow (fn (n acc) (if (== n 0) acc (grow (- n 1) (* acc 2)))));"
+        "(let f (fn (i acc) (if (== i 0) acc (f (- i 1) (grow 60 1)))));"
+        "(f 200 0)",
+        NULL);
+    assert(as_int(val) == 1l << 60);
+
+    // fns that create fns stay in the interpreter
+    Code* make;
+    val = run_jit(
+        "(let make (fn (n) (fn () n)));"
+        "(let loop (fn (i acc) (if (== i 0) acc"
+        "    (loop (- i 1) (+ acc ((make i)))))));"
+        "(loop 1000 0)",
+        &make);
+    assert(as_int(val) == 500500);
+    assert(make->native == NULL);
+}
+
+void test_jit_deep_recursion() {
+    // recursion deeper than native code is allowed to go continues in the
+    // interpreter
+    Val val = run_jit(
+        "(let sum (fn (n) (if (== n 0) 0 (+ n (sum (- n 1))))));"
+        "(sum 100000)",
+        NULL);
+    assert(as_int(val) == 5000050000);
+}
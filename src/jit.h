@@ -0,0 +1,35 @@
+#ifndef SPORK_JIT_H_
+#define SPORK_JIT_H_
+#include <stdbool.h>
+
+#include "compiler.h"
+#include "vm.h"
+
+// a function is compiled to native code on this call
+#define JIT_THRESHOLD 100
+
+// the JIT emits x86-64, so on any other architecture jit_compile compiles
+// nothing, and every call stays in the interpreter
+#if defined(__x86_64__)
+#define JIT_SUPPORTED
+#endif
+
+/**
+ * @brief NativeFn results, besides the index of the instruction the
+ * interpreter has to continue the call at. JIT_RETURNED means the call
+ * returned the value on top of the VM's stack. JIT_CALLED means the call made
+ * a call that the interpreter has to finish first, and the caller continues
+ * in the interpreter after that.
+ */
+#define JIT_RETURNED -1
+#define JIT_CALLED -2
+
+extern bool jit_enabled;
+
+bool jit_compile(Code* code);
+
+// TESTS
+void test_jit_compiles_hot_fns();
+void test_jit_falls_back();
+void test_jit_deep_recursion();
+#endif
@@ -1,116 +1,129 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "aot.h"
+#include "builtins.h"
+#include "compiler.h"
+#include "gc.h"
 #include "interpreter.h"
+#include "jit.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "par.h"
 #include "parser.h"
+#include "resolver.h"
+#include "typechecker.h"
 #include "utils.h"
-
-void assert_binary_int_op(Tuple tup) {
-    assert(cvector_size(tup.values) == 2);
-    assert(tup.values[0].kind == LiteralVal);
-    assert(tup.values[1].kind == LiteralVal);
-    assert(tup.values[0].type.lit.kind == IntLit);
-    assert(tup.values[1].type.lit.kind == IntLit);
-}
-
-Val builtin_add(Tuple tup) {
-    assert_binary_int_op(tup);
-    return (Val){
-        .kind = LiteralVal,
-        .type.lit = (Literal){.kind = IntLit,
-                              .type.Int = tup.values[0].type.lit.type.Int +
-                                          tup.values[1].type.lit.type.Int}};
-}
-
-Val builtin_sub(Tuple tup) {
-    assert_binary_int_op(tup);
-    return (Val){
-        .kind = LiteralVal,
-        .type.lit = (Literal){.kind = IntLit,
-                              .type.Int = tup.values[0].type.lit.type.Int -
-                                          tup.values[1].type.lit.type.Int}};
-}
-
-Val builtin_mul(Tuple tup) {
-    assert_binary_int_op(tup);
-    return (Val){
-        .kind = LiteralVal,
-        .type.lit = (Literal){.kind = IntLit,
-                              .type.Int = tup.values[0].type.lit.type.Int *
-                                          tup.values[1].type.lit.type.Int}};
-}
-
-Val builtin_div(Tuple tup) {
-    assert_binary_int_op(tup);
-    return (Val){
-        .kind = LiteralVal,
-        .type.lit = (Literal){.kind = IntLit,
-                              .type.Int = tup.values[0].type.lit.type.Int /
-                                          tup.values[1].type.lit.type.Int}};
-}
-
-Val builtin_eq(Tuple tup) {
-    assert_binary_int_op(tup);
-    return (Val){
-        .kind = LiteralVal,
-        .type.lit = (Literal){.kind = BoolLit,
-                              .type.Bool = tup.values[0].type.lit.type.Int ==
-                                           tup.values[1].type.lit.type.Int}};
-}
-
-Val builtin_print(Tuple tup) {
-    assert(cvector_size(tup.values) == 1);
-    assert(tup.values[0].kind == LiteralVal);
-    assert(tup.values[0].type.lit.kind == StringLit);
-    printf("%s", tup.values[0].type.lit.type.String);
-    return (Val){.kind = VoidVal};
+#include "vm.h"
+
+/**
+ * @brief the value of an option that takes a count, which has to be a whole
+ * number from 1 to max. Anything else is reported, and aborts.
+ *
+ * @param option
+ * @param value
+ * @param max
+ * @return unsigned long
+ */
+static unsigned long parse_count(char *option, char *value, unsigned long max) {
+    char *end;
+    errno = 0;
+    unsigned long count = strtoul(value, &end, 10);
+    // strtoul takes signs and skips whitespace, neither of which make sense
+    // for a count
+    if (!isdigit(*value) || *end != '\0' || errno == ERANGE || count == 0 ||
+        count > max) {
+        fprintf(stderr, "invalid value for %s: %s\n", option, value);
+        abort();
+    }
+    return count;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    bool dump_bytecode = false;
+    bool show_gc_stats = false;
+    bool show_memo_stats = false;
+    bool show_optimizer_stats = false;
+    bool emit_c_source = false;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--bytecode") == 0) {
+            dump_bytecode = true;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            show_gc_stats = true;
+        } else if (strcmp(argv[i], "--optimizer-stats") == 0) {
+            show_optimizer_stats = true;
+        } else if (strcmp(argv[i], "--no-inline") == 0) {
+            inline_enabled = false;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emit_c_source = true;
+        } else if (strcmp(argv[i], "--memo-stats") == 0) {
+            show_memo_stats = true;
+        } else if (strcmp(argv[i], "--memo-capacity") == 0 &&
+                   i + 1 < argc - 1) {
+            memo_capacity = parse_count("--memo-capacity", argv[++i],
+                                        MAX_MEMO_CAPACITY);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit_enabled = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc - 1) {
+            par_threads = parse_count("--threads", argv[++i], MAX_THREADS);
+        } else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc - 1) {
+            par_chunk_size = parse_count("--chunk-size", argv[++i], INT_MAX);
+        } else if (strcmp(argv[i], "--max-stack") == 0 && i + 1 < argc - 1) {
+            vm_max_stack = parse_count("--max-stack", argv[++i],
+                                       SIZE_MAX / (1024 * 1024)) *
+                           1024 * 1024;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            abort();
+        }
+    }
+    if (argc < 2) {
         fprintf(stderr, "provide one file to compile\n");
         abort();
     }
-    char *program = read_file_to_string(argv[1]);
+    char *filename = argv[argc - 1];
+    char *program = read_file_to_string(filename);
     if (program == NULL) {
-        fprintf(stderr, "file %s does not exist", argv[1]);
+        fprintf(stderr, "file %s does not exist", filename);
     }
 
     Expression *expr = parse_expr(&program);
-
     cvector_vector_type(LexicalBinding) env = NULL;
-    LexicalBinding binding;
-    binding = (LexicalBinding){
-        .symbol = "+",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_add}};
-    cvector_push_back(env, binding);
-
-    binding = (LexicalBinding){
-        .symbol = "-",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_sub}};
-    cvector_push_back(env, binding);
-
-    binding = (LexicalBinding){
-        .symbol = "==",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_eq}};
-    cvector_push_back(env, binding);
-
-    binding = (LexicalBinding){
-        .symbol = "*",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_mul}};
-    cvector_push_back(env, binding);
-
-    binding = (LexicalBinding){
-        .symbol = "/",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_div}};
-    cvector_push_back(env, binding);
-
-    binding = (LexicalBinding){
-        .symbol = "print",
-        .boundValue = (Val){.kind = BuiltinFnVal, .type.bfn = builtin_print}};
-    cvector_push_back(env, binding);
-
-
+    add_builtins(&env);
+    OptimizerStats optimizer_stats = optimize(expr, &env);
+    if (show_optimizer_stats) {
+        fprintf(stderr,
+                "optimizer: %d nodes eliminated, %d constants propagated, "
+                "%d calls inlined\n",
+                optimizer_stats.eliminated, optimizer_stats.propagated,
+                optimizer_stats.inlined);
+    }
+    if (dump_bytecode) {
+        FrameLayout frame = resolve(expr, &env);
+        typecheck(expr);
+        print_code(compile(expr, frame));
+        return 0;
+    }
+    if (emit_c_source) {
+        // resolving adds the program's globals to env, which can move it
+        FrameLayout frame = resolve(expr, &env);
+        typecheck(expr);
+        Code *code = compile(expr, frame);
+        emit_c(code, env, stdout);
+        return 0;
+    }
 
     print_val(eval(expr, &env));
+    if (show_gc_stats) {
+        print_gc_stats();
+    }
+    if (show_memo_stats) {
+        print_memo_stats();
+    }
     free_expr(expr);
 }
@@ -0,0 +1,221 @@
+#include "memo.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/hashmap/hashmap.h"
+#include "builtins.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "utils.h"
+
+/**
+ * @brief the result of a call. args is a copy of the args it was made with,
+ * owned by the entry.
+ */
+typedef struct MemoEntry {
+    Val* args;
+    int argc;
+    uint64_t hash;
+    Val result;
+} MemoEntry;
+
+/**
+ * @brief order holds the keys of the entries in the order they were added,
+ * as a ring buffer of memo_capacity keys that starts at oldest.
+ */
+struct Memo {
+    struct hashmap* entries;
+    MemoEntry* order;
+    size_t capacity;
+    size_t oldest;
+};
+
+size_t memo_capacity = MEMO_CAPACITY;
+
+static MemoStats stats = {.hits = 0, .misses = 0, .evictions = 0};
+
+// memos (and stats) are shared by every thread that runs spork code
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief ints are compared by value, even when they are boxed. Everything
+ * else is compared by identity, which can only miss results, not return the
+ * wrong one: the memo keeps its keys alive, so their objects can't be reused.
+ */
+static uint64_t key_bits(Val val) {
+    return is_int(val) ? (uint64_t)as_int(val) : val;
+}
+
+static uint64_t hash_args(Val* args, int argc) {
+    uint64_t keys[argc + 1];
+    for (int i = 0; i < argc; i++) {
+        keys[i] = key_bits(args[i]);
+    }
+    return hashmap_sip(keys, sizeof(uint64_t) * argc, 0, 0);
+}
+
+static uint64_t entry_hash(const void* item, uint64_t seed0, uint64_t seed1) {
+    return ((const MemoEntry*)item)->hash;
+}
+
+static int entry_compare(const void* a, const void* b, void* udata) {
+    const MemoEntry* entry_a = a;
+    const MemoEntry* entry_b = b;
+    if (entry_a->argc != entry_b->argc) {
+        return 1;
+    }
+    for (int i = 0; i < entry_a->argc; i++) {
+        if (key_bits(entry_a->args[i]) != key_bits(entry_b->args[i]) ||
+            is_int(entry_a->args[i]) != is_int(entry_b->args[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+Memo* new_memo() {
+    Memo* memo = malloc(sizeof(Memo));
+    memo->entries = hashmap_new(sizeof(MemoEntry), 0, 0, 0, entry_hash,
+                                entry_compare, NULL, NULL);
+    memo->capacity = memo_capacity > 0 ? memo_capacity : 1;
+    memo->order = memo->capacity <= SIZE_MAX / sizeof(MemoEntry)
+                      ? malloc(sizeof(MemoEntry) * memo->capacity)
+                      : NULL;
+    if (memo->order == NULL) {
+        fprintf(stderr, "out of memory\n");
+        abort();
+    }
+    memo->oldest = 0;
+    return memo;
+}
+
+void free_memo(Memo* memo) {
+    size_t i = 0;
+    void* item;
+    while (hashmap_iter(memo->entries, &i, &item)) {
+        free(((MemoEntry*)item)->args);
+    }
+    hashmap_free(memo->entries);
+    free(memo->order);
+    free(memo);
+}
+
+/**
+ * @brief look up the result of calling the fn of memo with args.
+ *
+ * @return bool whether there is one, in which case it's stored in result
+ */
+bool memo_get(Memo* memo, Val* args, int argc, Val* result) {
+    MemoEntry key = {.args = args, .argc = argc, .hash = hash_args(args, argc)};
+    pthread_mutex_lock(&lock);
+    const MemoEntry* entry = hashmap_get(memo->entries, &key);
+    if (entry == NULL) {
+        stats.misses++;
+    } else {
+        stats.hits++;
+        *result = entry->result;
+    }
+    pthread_mutex_unlock(&lock);
+    return entry != NULL;
+}
+
+/**
+ * @brief remember that calling the fn of memo with args returned result,
+ * evicting the oldest result if the memo is full.
+ */
+void memo_set(Memo* memo, Val* args, int argc, Val result) {
+    MemoEntry key = {.args = args, .argc = argc, .hash = hash_args(args, argc)};
+    pthread_mutex_lock(&lock);
+    MemoEntry* existing = (MemoEntry*)hashmap_get(memo->entries, &key);
+    if (existing != NULL) {
+        existing->result = result;
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    size_t count = hashmap_count(memo->entries);
+    if (count == memo->capacity) {
+        MemoEntry* evicted = hashmap_delete(memo->entries,
+                                            &memo->order[memo->oldest]);
+        free(evicted->args);
+        memo->oldest = (memo->oldest + 1) % memo->capacity;
+        count--;
+        stats.evictions++;
+    }
+    key.args = malloc(sizeof(Val) * (argc + 1));
+    memcpy(key.args, args, sizeof(Val) * argc);
+    key.result = result;
+    hashmap_set(memo->entries, &key);
+    memo->order[(memo->oldest + count) % memo->capacity] = key;
+    pthread_mutex_unlock(&lock);
+}
+
+void mark_memo(Memo* memo) {
+    size_t i = 0;
+    void* item;
+    while (hashmap_iter(memo->entries, &i, &item)) {
+        MemoEntry* entry = item;
+        for (int j = 0; j < entry->argc; j++) {
+            gc_mark_val(entry->args[j]);
+        }
+        gc_mark_val(entry->result);
+    }
+}
+
+MemoStats memo_stats() { return stats; }
+
+void print_memo_stats() {
+    fprintf(stderr, "memo: %zu hits, %zu misses, %zu evictions\n", stats.hits,
+            stats.misses, stats.evictions);
+}
+
+// TESTS
+void test_memo_get_set() {
+    Memo* memo = new_memo();
+    Val args[] = {int_val(1), int_val(1l << 60)};
+    Val result;
+    assert(!memo_get(memo, args, 2, &result));
+    memo_set(memo, args, 2, int_val(3));
+    // boxed ints are compared by value
+    Val same[] = {int_val(1), int_val(1l << 60)};
+    assert(memo_get(memo, same, 2, &result));
+    assert(as_int(result) == 3);
+    assert(!memo_get(memo, args, 1, &result));
+    free_memo(memo);
+}
+
+void test_memo_evicts() {
+    size_t capacity = memo_capacity;
+    memo_capacity = 4;
+    Memo* memo = new_memo();
+    memo_capacity = capacity;
+    MemoStats before = memo_stats();
+    for (int i = 0; i < 6; i++) {
+        Val arg = int_val(i);
+        memo_set(memo, &arg, 1, int_val(i * i));
+    }
+    assert(memo_stats().evictions == before.evictions + 2);
+    Val result;
+    for (int i = 0; i < 6; i++) {
+        Val arg = int_val(i);
+        // the oldest results are the ones evicted
+        assert(memo_get(memo, &arg, 1, &result) == (i >= 2));
+    }
+    free_memo(memo);
+}
+
+void test_memo_fns() {
+    char program[] =
+        "(let fib (memo (fn (n)"
+        "    (if (== n 0) 0 (if (== n 1) 1 (+ (fib (- n 1)) (fib (- n 2))))))));"
+        "(fib 80)";
+    MemoStats before = memo_stats();
+    assert(as_int(run_source(program)) == 23416728348467685l);
+    // every fib is computed once, and looked up once more
+    assert(memo_stats().misses - before.misses == 81);
+    assert(memo_stats().hits - before.hits == 78);
+}
@@ -0,0 +1,39 @@
+#ifndef SPORK_MEMO_H_
+#define SPORK_MEMO_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "value.h"
+
+// how many results a memoized fn keeps, unless --memo-capacity says otherwise
+#define MEMO_CAPACITY 4096
+// the most --memo-capacity can ask for
+#define MAX_MEMO_CAPACITY (1ul << 32)
+
+/**
+ * @brief the results of the calls of a memoized fn, keyed by their args. Once
+ * it holds memo_capacity results, the oldest one is evicted for every new one.
+ */
+typedef struct Memo Memo;
+
+typedef struct MemoStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} MemoStats;
+
+extern size_t memo_capacity;
+
+Memo* new_memo();
+void free_memo(Memo* memo);
+bool memo_get(Memo* memo, Val* args, int argc, Val* result);
+void memo_set(Memo* memo, Val* args, int argc, Val result);
+void mark_memo(Memo* memo);
+MemoStats memo_stats();
+void print_memo_stats();
+
+// TESTS
+void test_memo_get_set();
+void test_memo_evicts();
+void test_memo_fns();
+#endif
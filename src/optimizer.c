@@ -0,0 +1,696 @@
+#include "optimizer.h"
+
+#include <string.h>
+
+#include "builtins.h"
+#include "utils.h"
+#include "value.h"
+
+/**
+ * @brief a variable whose value is known while optimizing: a let binds it to
+ * a literal, and nothing else in the program binds the same name.
+ */
+typedef struct Constant {
+    Symbol symbol;
+    Literal value;
+} Constant;
+
+/**
+ * @brief a fn that calls can be replaced with the body of: a let binds the
+ * variable to it, and nothing else binds the same name (see is_inlinable).
+ */
+typedef struct Inlinable {
+    Symbol symbol;
+    Expression* fn;
+} Inlinable;
+
+typedef struct Folder {
+    cvector_vector_type(LexicalBinding) * env;
+    // every name a let or a param binds, once for each time it does
+    cvector_vector_type(Symbol) bindings;
+    cvector_vector_type(Constant) visible;
+    cvector_vector_type(Inlinable) inlinable;
+    OptimizerStats stats;
+} Folder;
+
+bool inline_enabled = true;
+
+typedef struct PureBuiltin {
+    char* name;
+    BuiltinFn fn;
+    Symbol symbol;
+} PureBuiltin;
+
+/**
+ * @brief the builtins that can run at compile time, because they only depend
+ * on their args and have no effects besides returning their result.
+ */
+static PureBuiltin pure_builtins[] = {{.name = "+", .fn = builtin_add},
+                                      {.name = "-", .fn = builtin_sub},
+                                      {.name = "*", .fn = builtin_mul},
+                                      {.name = "/", .fn = builtin_div},
+                                      {.name = "==", .fn = builtin_eq}};
+
+static void fold_expr(Folder* folder, Expression* expr);
+static void fold_node(Folder* folder, Expression* expr);
+
+static Symbol get_as_symbol(Expression* expr) {
+    return (expr->atomic && expr->data.atom.kind == SymbolAtom)
+               ? expr->data.atom.type.symbol
+               : NULL;
+}
+
+/**
+ * @brief whether the value of expr (including the rest of its chain) is a
+ * literal.
+ */
+static bool is_literal(Expression* expr) {
+    return expr->atomic && expr->data.atom.kind == LiteralAtom &&
+           expr->chain == NULL;
+}
+
+static Literal copy_literal(Literal literal) {
+    if (literal.kind == StringLit) {
+        literal.type.String = sdsdup(literal.type.String);
+    }
+    return literal;
+}
+
+static int count_nodes(Expression* expr);
+
+static int count_chain(Expression* expr) {
+    int count = 0;
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        count += count_nodes(curr);
+    }
+    return count;
+}
+
+/**
+ * @brief the number of expressions in expr, not counting the rest of its chain
+ */
+static int count_nodes(Expression* expr) {
+    int count = 1;
+    if (!expr->atomic) {
+        for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+            count += count_chain(expr->data.expr[i]);
+        }
+    }
+    return count;
+}
+
+static void free_chain(Expression* expr) {
+    while (expr != NULL) {
+        Expression* chain = expr->chain;
+        free_expr(expr);
+        expr = chain;
+    }
+}
+
+/**
+ * @brief replace expr with the literal, keeping the rest of its chain.
+ */
+static void replace_with_literal(Folder* folder, Expression* expr,
+                                 Literal literal) {
+    folder->stats.eliminated += count_nodes(expr) - 1;
+    if (expr->atomic) {
+        free_literal(expr->data.atom.type.literal);
+    } else {
+        for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+            free_chain(expr->data.expr[i]);
+        }
+        cvector_free(expr->data.expr);
+    }
+    expr->atomic = true;
+    expr->form = AtomForm;
+    expr->data.atom = (Atom){.kind = LiteralAtom, .type.literal = literal};
+}
+
+/**
+ * @brief replace expr with with, keeping the rest of the chain of expr. with
+ * can't have a chain of its own, since the variables its lets declare would
+ * then be visible in the chain of expr. Every child of expr is freed, unless
+ * it has been set to NULL.
+ */
+static void replace_with(Expression* expr, Expression* with) {
+    assert(with->chain == NULL);
+    for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+        if (expr->data.expr[i] != NULL) {
+            free_chain(expr->data.expr[i]);
+        }
+    }
+    cvector_free(expr->data.expr);
+    Expression* chain = expr->chain;
+    *expr = *with;
+    expr->chain = chain;
+    free(with);
+}
+
+static void replace_with_child(Folder* folder, Expression* expr, int index) {
+    Expression* child = expr->data.expr[index];
+    folder->stats.eliminated += count_nodes(expr) - count_nodes(child);
+    expr->data.expr[index] = NULL;
+    replace_with(expr, child);
+}
+
+static Expression* copy_expr(Expression* expr) {
+    Expression* copy = malloc(sizeof(Expression));
+    *copy = *expr;
+    if (expr->atomic) {
+        if (expr->data.atom.kind == LiteralAtom) {
+            copy->data.atom.type.literal =
+                copy_literal(expr->data.atom.type.literal);
+        }
+    } else {
+        copy->data.expr = NULL;
+        for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+            cvector_push_back(copy->data.expr, copy_expr(expr->data.expr[i]));
+        }
+    }
+    copy->chain = expr->chain == NULL ? NULL : copy_expr(expr->chain);
+    return copy;
+}
+
+static int count_bindings(Folder* folder, Symbol symbol) {
+    int count = 0;
+    for (int i = 0; i < cvector_size(folder->bindings); i++) {
+        count += folder->bindings[i] == symbol;
+    }
+    return count;
+}
+
+static void collect_bindings(Folder* folder, Expression* expr) {
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        if (curr->atomic) {
+            continue;
+        }
+        cvector_vector_type(Expression*) children = curr->data.expr;
+        if (curr->form == LetForm && cvector_size(children) == 3 &&
+            get_as_symbol(children[1]) != NULL) {
+            cvector_push_back(folder->bindings, get_as_symbol(children[1]));
+        } else if (curr->form == FnForm && cvector_size(children) == 3 &&
+                   !children[1]->atomic) {
+            cvector_vector_type(Expression*) params = children[1]->data.expr;
+            for (int i = 0; i < cvector_size(params); i++) {
+                if (get_as_symbol(params[i]) != NULL) {
+                    cvector_push_back(folder->bindings,
+                                      get_as_symbol(params[i]));
+                }
+            }
+        }
+        for (int i = 0; i < cvector_size(children); i++) {
+            collect_bindings(folder, children[i]);
+        }
+    }
+}
+
+/**
+ * @brief the builtin that callee names, if it's pure and nothing rebinds its
+ * name, or NULL.
+ */
+static BuiltinFn get_pure_builtin(Folder* folder, Expression* callee) {
+    if (pure_builtins[0].symbol == NULL) {
+        for (int i = 0; i < ARRAY_LEN(pure_builtins); i++) {
+            pure_builtins[i].symbol = intern(pure_builtins[i].name);
+        }
+    }
+    Symbol symbol = get_as_symbol(callee);
+    if (symbol == NULL || count_bindings(folder, symbol) > 0) {
+        return NULL;
+    }
+    for (int i = 0; i < ARRAY_LEN(pure_builtins); i++) {
+        if (pure_builtins[i].symbol != symbol) {
+            continue;
+        }
+        // the global may have been rebound by a program run earlier in env
+        for (int j = cvector_size(*folder->env) - 1; j >= 0; j--) {
+            if ((*folder->env)[j].symbol == symbol) {
+                Val bound = (*folder->env)[j].boundValue;
+                return bound == builtin_val(pure_builtins[i].fn)
+                           ? pure_builtins[i].fn
+                           : NULL;
+            }
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+static void fold_symbol(Folder* folder, Expression* expr) {
+    Symbol symbol = expr->data.atom.type.symbol;
+    for (int i = cvector_size(folder->visible) - 1; i >= 0; i--) {
+        if (folder->visible[i].symbol == symbol) {
+            expr->data.atom = (Atom){
+                .kind = LiteralAtom,
+                .type.literal = copy_literal(folder->visible[i].value)};
+            folder->stats.propagated++;
+            return;
+        }
+    }
+}
+
+static int find_param(cvector_vector_type(Expression*) params, Symbol symbol) {
+    for (int i = 0; i < cvector_size(params); i++) {
+        if (get_as_symbol(params[i]) == symbol) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief whether expr can be copied into a call site as the body of an
+ * inlined fn: it is made of nothing but calls, ifs and atoms (so it declares
+ * no variables of its own), and the only symbols in it besides params are
+ * bound nowhere in the program (so they mean the same thing everywhere).
+ */
+static bool is_simple_body(Folder* folder, Expression* expr,
+                           cvector_vector_type(Expression*) params) {
+    if (expr->chain != NULL) {
+        return false;
+    }
+    if (expr->atomic) {
+        Symbol symbol = get_as_symbol(expr);
+        return symbol == NULL || find_param(params, symbol) != -1 ||
+               count_bindings(folder, symbol) == 0;
+    }
+    if (expr->form != CallForm && expr->form != IfForm) {
+        return false;
+    }
+    for (int i = expr->form == IfForm ? 1 : 0; i < cvector_size(expr->data.expr);
+         i++) {
+        if (!is_simple_body(folder, expr->data.expr[i], params)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief whether calls of the fn that a let binds variable to can be inlined.
+ * The fn has to be small, and can't call itself: its body can only refer to
+ * names nothing in the program binds, which variable is not.
+ */
+static bool is_inlinable(Folder* folder, Symbol variable, Expression* fn) {
+    if (!inline_enabled || variable == NULL || fn->form != FnForm ||
+        fn->chain != NULL || cvector_size(fn->data.expr) != 3 ||
+        fn->data.expr[1]->atomic || count_bindings(folder, variable) != 1) {
+        return false;
+    }
+    cvector_vector_type(Expression*) params = fn->data.expr[1]->data.expr;
+    for (int i = 0; i < cvector_size(params); i++) {
+        if (get_as_symbol(params[i]) == NULL) {
+            return false;
+        }
+    }
+    Expression* body = fn->data.expr[2];
+    return count_nodes(body) <= INLINE_MAX_NODES &&
+           is_simple_body(folder, body, params);
+}
+
+/**
+ * @brief count the uses of symbol in expr, and whether any of them is in a
+ * branch of an if, where it might not be evaluated.
+ */
+static int count_uses(Expression* expr, Symbol symbol, bool in_branch,
+                      bool* conditional) {
+    if (expr->atomic) {
+        if (get_as_symbol(expr) == symbol) {
+            *conditional |= in_branch;
+            return 1;
+        }
+        return 0;
+    }
+    int uses = 0;
+    for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+        bool branch = in_branch || (expr->form == IfForm && i >= 2);
+        uses += count_uses(expr->data.expr[i], symbol, branch, conditional);
+    }
+    return uses;
+}
+
+/**
+ * @brief whether expr calls anything besides pure builtins.
+ */
+static bool has_effects(Folder* folder, Expression* expr) {
+    if (expr->atomic) {
+        return false;
+    }
+    if (expr->form == CallForm &&
+        get_pure_builtin(folder, expr->data.expr[0]) == NULL) {
+        return true;
+    }
+    for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+        if (has_effects(folder, expr->data.expr[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief whether replacing each param of fn with its arg in call evaluates
+ * the args the same as the call would. Symbols and literals can be evaluated
+ * any number of times in any order. Any other arg (at most one) has to be
+ * used exactly once, unconditionally, and by a body that has no effects of its
+ * own that could happen before it.
+ */
+static bool args_substitutable(Folder* folder, Expression* call,
+                               Expression* fn) {
+    cvector_vector_type(Expression*) params = fn->data.expr[1]->data.expr;
+    Expression* body = fn->data.expr[2];
+    bool complex_arg = false;
+    for (int i = 1; i < cvector_size(call->data.expr); i++) {
+        Expression* arg = call->data.expr[i];
+        if (is_literal(arg) || (get_as_symbol(arg) != NULL)) {
+            continue;
+        }
+        bool conditional = false;
+        Symbol param = get_as_symbol(params[i - 1]);
+        if (complex_arg || count_uses(body, param, false, &conditional) != 1 ||
+            conditional || has_effects(folder, body)) {
+            return false;
+        }
+        complex_arg = true;
+    }
+    return true;
+}
+
+static Expression* substitute(Expression* body,
+                              cvector_vector_type(Expression*) params,
+                              Expression** args) {
+    if (body->atomic) {
+        int param = find_param(params, get_as_symbol(body));
+        if (get_as_symbol(body) == NULL || param == -1) {
+            return copy_expr(body);
+        }
+        Expression* arg = args[param];
+        if (is_literal(arg) || get_as_symbol(arg) != NULL) {
+            return copy_expr(arg);
+        }
+        // args that aren't trivial are used exactly once, so they can move
+        args[param] = NULL;
+        return arg;
+    }
+    Expression* copy = malloc(sizeof(Expression));
+    *copy = *body;
+    copy->data.expr = NULL;
+    for (int i = 0; i < cvector_size(body->data.expr); i++) {
+        cvector_push_back(copy->data.expr,
+                          substitute(body->data.expr[i], params, args));
+    }
+    return copy;
+}
+
+/**
+ * @brief replace a call of an inlinable fn with the fn's body, with the args of
+ * the call in place of its params, and fold the result.
+ */
+static void inline_call(Folder* folder, Expression* call) {
+    Symbol callee = get_as_symbol(call->data.expr[0]);
+    if (callee == NULL) {
+        return;
+    }
+    for (int i = cvector_size(folder->inlinable) - 1; i >= 0; i--) {
+        if (folder->inlinable[i].symbol != callee) {
+            continue;
+        }
+        Expression* fn = folder->inlinable[i].fn;
+        cvector_vector_type(Expression*) params = fn->data.expr[1]->data.expr;
+        if (cvector_size(call->data.expr) != cvector_size(params) + 1 ||
+            !args_substitutable(folder, call, fn)) {
+            return;
+        }
+        Expression* body =
+            substitute(fn->data.expr[2], params, call->data.expr + 1);
+        replace_with(call, body);
+        folder->stats.inlined++;
+        fold_node(folder, call);
+        return;
+    }
+}
+
+/**
+ * @brief run a call of a pure builtin on int literals. Calls that would fail
+ * (like dividing by zero) are left for the program to fail at.
+ */
+static void fold_call(Folder* folder, Expression* expr) {
+    for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+        fold_expr(folder, expr->data.expr[i]);
+    }
+    if (inline_enabled) {
+        inline_call(folder, expr);
+        if (expr->form != CallForm) {
+            return;
+        }
+    }
+    if (cvector_size(expr->data.expr) != 3) {
+        return;
+    }
+    BuiltinFn bfn = get_pure_builtin(folder, expr->data.expr[0]);
+    if (bfn == NULL) {
+        return;
+    }
+    Val args[2];
+    for (int i = 0; i < 2; i++) {
+        Expression* arg = expr->data.expr[i + 1];
+        if (!is_literal(arg) || arg->data.atom.type.literal.kind != IntLit) {
+            return;
+        }
+        args[i] = int_val(arg->data.atom.type.literal.type.Int);
+    }
+    if (bfn == builtin_div && as_int(args[1]) == 0) {
+        return;
+    }
+    // a bigint has no literal, so it's left for the program to compute. The
+    // arithmetic builtins don't call anything, so they don't need a VM.
+    Val result = bfn(NULL, args, 2);
+    if (!is_bigint(result)) {
+        replace_with_literal(folder, expr, as_literal(result));
+    }
+}
+
+static void fold_if(Folder* folder, Expression* expr) {
+    assert(cvector_size(expr->data.expr) == 4);
+    for (int i = 1; i < 4; i++) {
+        fold_expr(folder, expr->data.expr[i]);
+    }
+    Expression* condition = expr->data.expr[1];
+    if (!is_literal(condition) ||
+        condition->data.atom.type.literal.kind != BoolLit) {
+        return;
+    }
+    int taken = condition->data.atom.type.literal.type.Bool ? 2 : 3;
+    if (expr->data.expr[taken]->chain == NULL) {
+        replace_with_child(folder, expr, taken);
+    }
+}
+
+/**
+ * @brief fold a single expression, without the rest of its chain.
+ */
+static void fold_node(Folder* folder, Expression* expr) {
+    switch (expr->form) {
+        case AtomForm:
+            if (expr->data.atom.kind == SymbolAtom) {
+                fold_symbol(folder, expr);
+            }
+            break;
+        case CommentForm:
+            break;
+        case LetForm:
+            assert(cvector_size(expr->data.expr) == 3);
+            fold_expr(folder, expr->data.expr[2]);
+            break;
+        case FnForm:
+            assert(cvector_size(expr->data.expr) == 3);
+            fold_expr(folder, expr->data.expr[2]);
+            break;
+        case MemoForm:
+            if (cvector_size(expr->data.expr) == 2) {
+                fold_expr(folder, expr->data.expr[1]);
+            }
+            break;
+        case IfForm:
+            fold_if(folder, expr);
+            break;
+        case CallForm:
+            fold_call(folder, expr);
+            break;
+        case ParForm:
+        case SpawnForm:
+            for (int i = 1; i < cvector_size(expr->data.expr); i++) {
+                fold_expr(folder, expr->data.expr[i]);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief fold expr and the rest of its chain. A let of a literal makes its
+ * variable a constant until the end of the chain, which is where the variable
+ * is visible, and a let of a small fn makes the calls of it there inlinable.
+ */
+static void fold_expr(Folder* folder, Expression* expr) {
+    int visible = cvector_size(folder->visible);
+    int inlinable = cvector_size(folder->inlinable);
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        fold_node(folder, curr);
+        if (curr->form != LetForm) {
+            continue;
+        }
+        Symbol variable = get_as_symbol(curr->data.expr[1]);
+        Expression* value = curr->data.expr[2];
+        if (variable != NULL && is_literal(value) &&
+            count_bindings(folder, variable) == 1) {
+            Constant constant = {.symbol = variable,
+                                 .value = value->data.atom.type.literal};
+            cvector_push_back(folder->visible, constant);
+        } else if (is_inlinable(folder, variable, value)) {
+            Inlinable fn = {.symbol = variable, .fn = value};
+            cvector_push_back(folder->inlinable, fn);
+        }
+    }
+    cvector_set_size(folder->visible, visible);
+    cvector_set_size(folder->inlinable, inlinable);
+}
+
+/**
+ * @brief evaluate the parts of program that don't depend on anything that
+ * happens at runtime: calls of pure builtins on literals, variables bound to
+ * literals, and ifs with a literal condition. Calls of small fns are replaced
+ * with their body (unless inline_enabled is off), which is folded in turn with
+ * the args of the call. Runs between parsing and resolving, and changes
+ * program in place.
+ *
+ * @param program
+ * @param env the global environment the program will run in
+ * @return OptimizerStats
+ */
+OptimizerStats optimize(Expression* program,
+                        cvector_vector_type(LexicalBinding) * env) {
+    Folder folder = {.env = env,
+                     .bindings = NULL,
+                     .visible = NULL,
+                     .inlinable = NULL,
+                     .stats = {.eliminated = 0, .propagated = 0, .inlined = 0}};
+    collect_bindings(&folder, program);
+    fold_expr(&folder, program);
+    cvector_free(folder.bindings);
+    cvector_free(folder.visible);
+    cvector_free(folder.inlinable);
+    return folder.stats;
+}
+
+// TESTS
+static Expression* optimize_string(char* program, OptimizerStats* stats) {
+    Expression* expr = parse_source(program);
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    *stats = optimize(expr, &env);
+    return expr;
+}
+
+static long as_int_literal(Expression* expr) {
+    assert(is_literal(expr));
+    assert(expr->data.atom.type.literal.kind == IntLit);
+    return expr->data.atom.type.literal.type.Int;
+}
+
+void test_fold_arithmetic() {
+    OptimizerStats stats;
+    Expression* expr = optimize_string("(# math); (* (+ 1 2) 5)", &stats);
+    assert(as_int_literal(expr->chain) == 15);
+    assert(stats.eliminated == 6);
+
+    // dividing by zero still fails when the program runs
+    expr = optimize_string("(/ 1 (- 2 2))", &stats);
+    assert(expr->form == CallForm);
+    assert(as_int_literal(expr->data.expr[2]) == 0);
+    assert(stats.eliminated == 3);
+}
+
+void test_fold_propagates_lets() {
+    OptimizerStats stats;
+    Expression* expr = optimize_string(
+        "(let x 4); (let f (fn (a) (+ a (* x x)))); (f x)", &stats);
+    Expression* body = expr->chain->data.expr[2]->data.expr[2];
+    assert(as_int_literal(body->data.expr[2]) == 16);
+    // f is small enough to inline, which folds the call too
+    assert(as_int_literal(expr->chain->chain) == 20);
+    assert(stats.propagated == 3);
+
+    // a variable that is bound more than once isn't constant
+    expr = optimize_string("(let x 4); (let f (fn (x) (+ x 1))); (f x)", &stats);
+    assert(stats.propagated == 0);
+}
+
+void test_fold_prunes_ifs() {
+    OptimizerStats stats;
+    Expression* expr =
+        optimize_string("(let f (fn (a) (if (== 1 2) (print a) a))); f", &stats);
+    Expression* body = expr->data.expr[2]->data.expr[2];
+    assert(get_as_symbol(body) == intern("a"));
+    assert(body->chain == NULL);
+    assert(stats.eliminated == 9);
+
+    // the variables a branch declares aren't visible after the if
+    expr = optimize_string("(if true (let y 1); y 2)", &stats);
+    assert(expr->form == IfForm);
+}
+
+void test_fold_respects_rebinding() {
+    OptimizerStats stats;
+    inline_enabled = false;
+    Expression* expr =
+        optimize_string("(let + (fn (a b) (- a b))); (+ 1 2)", &stats);
+    inline_enabled = true;
+    assert(expr->chain->form == CallForm);
+    assert(stats.eliminated == 0);
+
+    // inlining the new + folds the call with it instead
+    expr = optimize_string("(let + (fn (a b) (- a b))); (+ 1 2)", &stats);
+    assert(as_int_literal(expr->chain) == -1);
+}
+
+void test_inline_small_fns() {
+    OptimizerStats stats;
+    Expression* expr = optimize_string(
+        "(let square (fn (x) (* x x))); (let f (fn (y) (square (+ y 1))));"
+        "(square 7)",
+        &stats);
+    assert(as_int_literal(expr->chain->chain) == 49);
+    // only one use of x can be an arg that isn't a symbol or a literal
+    Expression* body = expr->chain->data.expr[2]->data.expr[2];
+    assert(body->form == CallForm);
+    assert(get_as_symbol(body->data.expr[0]) == intern("square"));
+    assert(stats.inlined == 1);
+
+    expr = optimize_string("(let add1 (fn (x) (+ x 1))); (add1 (* 2 3))",
+                           &stats);
+    assert(as_int_literal(expr->chain) == 7);
+    assert(stats.inlined == 1);
+
+    inline_enabled = false;
+    expr = optimize_string("(let add1 (fn (x) (+ x 1))); (add1 2)", &stats);
+    inline_enabled = true;
+    assert(expr->chain->form == CallForm);
+    assert(stats.inlined == 0);
+}
+
+void test_inline_keeps_effects() {
+    OptimizerStats stats;
+    // inlining would print "a" after "b"
+    Expression* expr = optimize_string(
+        "(let f (fn (x) (print x); 1)); (let g (fn (a b) (print b)));"
+        "(g (print \"a\") \"b\")",
+        &stats);
+    assert(stats.inlined == 0);
+
+    // fns that call themselves are never inlined
+    expr = optimize_string(
+        "(let loop (fn (n) (if (== n 0) 0 (loop (- n 1))))); (loop 3)",
+        &stats);
+    assert(expr->chain->form == CallForm);
+    assert(stats.inlined == 0);
+}
@@ -0,0 +1,33 @@
+#ifndef SPORK_OPTIMIZER_H_
+#define SPORK_OPTIMIZER_H_
+#include "../lib/cvector/cvector.h"
+#include "interpreter.h"
+#include "parser.h"
+
+// fns whose body has more expressions than this are never inlined
+#define INLINE_MAX_NODES 16
+
+/**
+ * @brief what optimize did to a program. eliminated counts the expressions it
+ * removed, propagated the symbols it replaced with the constant they are bound
+ * to, and inlined the calls it replaced with the body of the fn called.
+ */
+typedef struct OptimizerStats {
+    int eliminated;
+    int propagated;
+    int inlined;
+} OptimizerStats;
+
+extern bool inline_enabled;
+
+OptimizerStats optimize(Expression* program,
+                        cvector_vector_type(LexicalBinding) * env);
+
+// TESTS
+void test_fold_arithmetic();
+void test_fold_propagates_lets();
+void test_fold_prunes_ifs();
+void test_fold_respects_rebinding();
+void test_inline_small_fns();
+void test_inline_keeps_effects();
+#endif
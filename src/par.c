@@ -0,0 +1,653 @@
+#include "par.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "async.h"
+#include "builtins.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "utils.h"
+
+int par_threads = 0;
+
+int par_chunk_size = 0;
+
+/**
+ * @brief tasks forked together, which the thread that forked them waits for.
+ * They run with the globals of the program that forked them.
+ */
+typedef struct Fork {
+    // the tasks that haven't finished yet
+    _Atomic int pending;
+    cvector_vector_type(LexicalBinding) * globals;
+} Fork;
+
+typedef struct Task Task;
+
+// what a task does, on the VM of whichever thread runs it
+typedef void (*TaskFn)(Task* task, VM* vm);
+
+/**
+ * @brief work that any thread in the pool can pick up. Tasks live on the C
+ * stack of the thread that forked them, which waits for all of them to
+ * finish. data and the range from start to end are what run works on.
+ */
+struct Task {
+    TaskFn run;
+    Fork* fork;
+    void* data;
+    int start;
+    int end;
+};
+
+typedef enum BulkKind { MapBulk, FilterBulk, ReduceBulk } BulkKind;
+
+/**
+ * @brief a pmap, pfilter or preduce of fn over input, which is split into
+ * chunks of chunk_size values. For a map or a filter, out has what fn
+ * returned for each value of input. For a reduce, it has a value for each
+ * chunk, which ends up as the reduction of the chunks of the subtree that the
+ * chunk starts (see run_chunks).
+ */
+typedef struct Bulk {
+    BulkKind kind;
+    Val fn;
+    Val init;
+    Tuple* input;
+    Tuple* out;
+    int chunk_size;
+    bool parallel;
+} Bulk;
+
+/**
+ * @brief a Chase-Lev work-stealing deque. Its owner pushes and pops tasks at
+ * bottom, while other threads steal them from top.
+ */
+typedef struct Deque {
+    _Atomic long top;
+    _Atomic long bottom;
+    _Atomic(Task*) tasks[DEQUE_CAPACITY];
+} Deque;
+
+typedef struct Worker {
+    Deque deque;
+    VM vm;
+    pthread_t thread;
+    unsigned seed;
+} Worker;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic bool started = false;
+static Worker* workers = NULL;
+static int worker_count = 0;
+// the worker the calling thread is, or NULL if it isn't in the pool
+static __thread Worker* self = NULL;
+
+// idle workers sleep until there is something to steal
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static _Atomic int sleeping = 0;
+
+// what a worker's VM is bound to while it isn't running a task
+static cvector_vector_type(LexicalBinding) no_globals = NULL;
+
+static bool push_task(Deque* deque, Task* task) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit(&deque->tasks[bottom % DEQUE_CAPACITY], task,
+                          memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+/// @brief the task its owner pushed last, or NULL if all of them are gone
+static Task* pop_task(Deque* deque) {
+    long bottom =
+        atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    Task* task = atomic_load_explicit(&deque->tasks[bottom % DEQUE_CAPACITY],
+                                      memory_order_relaxed);
+    if (top == bottom) {
+        // the last task, which a thief may be taking at the same time
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/// @brief the task that was pushed first, or NULL if there is none to take
+static Task* steal_task(Deque* deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return NULL;
+    }
+    Task* task = atomic_load_explicit(&deque->tasks[top % DEQUE_CAPACITY],
+                                      memory_order_relaxed);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+        return NULL;
+    }
+    return task;
+}
+
+/**
+ * @brief steal a task from any worker but thief, starting at a random one so
+ * thieves spread out.
+ */
+static Task* steal_any(Worker* thief) {
+    int start = rand_r(&thief->seed) % worker_count;
+    for (int i = 0; i < worker_count; i++) {
+        Worker* victim = &workers[(start + i) % worker_count];
+        if (victim == thief) {
+            continue;
+        }
+        Task* task = steal_task(&victim->deque);
+        if (task != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static bool has_work() {
+    for (int i = 0; i < worker_count; i++) {
+        Deque* deque = &workers[i].deque;
+        if (atomic_load(&deque->top) < atomic_load(&deque->bottom)) {
+            return true;
+        }
+    }
+    return async_ready();
+}
+
+static void run_task(Task* task, VM* vm) {
+    Fork* fork = task->fork;
+    cvector_vector_type(LexicalBinding)* globals = vm->globals;
+    vm->globals = fork->globals;
+    task->run(task, vm);
+    vm->globals = globals;
+    atomic_fetch_sub_explicit(&fork->pending, 1, memory_order_release);
+}
+
+/// @brief wake the idle workers, once there are tasks or fibers for them
+void par_wake_workers() {
+    // pairs with the increment of sleeping in sleep_until_work, so either the
+    // sleeper sees the work that was added or this sees the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&sleeping) > 0) {
+        pthread_mutex_lock(&sleep_lock);
+        pthread_cond_broadcast(&wake);
+        pthread_mutex_unlock(&sleep_lock);
+    }
+}
+
+static void sleep_until_work() {
+    // a sleeping worker holds no values, so collections don't wait for it
+    gc_block();
+    pthread_mutex_lock(&sleep_lock);
+    atomic_fetch_add(&sleeping, 1);
+    while (!has_work()) {
+        pthread_cond_wait(&wake, &sleep_lock);
+    }
+    atomic_fetch_sub(&sleeping, 1);
+    pthread_mutex_unlock(&sleep_lock);
+    gc_unblock();
+}
+
+static void* work(void* arg) {
+    self = arg;
+    for (int idle = 0;; idle++) {
+        Task* task = steal_any(self);
+        if (task != NULL) {
+            run_task(task, &self->vm);
+            idle = 0;
+        } else if (async_run_ready()) {
+            idle = 0;
+        } else if (idle < IDLE_ROUNDS) {
+            gc_safepoint();
+            sched_yield();
+        } else {
+            sleep_until_work();
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief start the pool, with the calling thread as its first worker. The
+ * other workers run until the program exits.
+ */
+static void start_pool() {
+    worker_count = par_threads > 0 ? par_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (worker_count < 2) {
+        return;
+    }
+    workers = calloc(worker_count, sizeof(Worker));
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].seed = i + 1;
+    }
+    self = &workers[0];
+    for (int i = 1; i < worker_count; i++) {
+        Worker* worker = &workers[i];
+        worker->vm = new_vm(&no_globals);
+        gc_add_roots(mark_vm, &worker->vm);
+        gc_add_mutator();
+        if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+            fprintf(stderr, "couldn't start a worker thread\n");
+            abort();
+        }
+    }
+}
+
+/// @brief start the pool, unless some thread already did
+void par_join_pool() {
+    if (atomic_load_explicit(&started, memory_order_acquire)) {
+        return;
+    }
+    pthread_mutex_lock(&start_lock);
+    if (!started) {
+        start_pool();
+        atomic_store_explicit(&started, true, memory_order_release);
+    }
+    pthread_mutex_unlock(&start_lock);
+}
+
+/**
+ * @brief run count tasks, and return once all of them have finished. Unless
+ * parallel is false or the calling thread isn't in the pool, the others are
+ * left for idle workers to steal while it runs the first one.
+ */
+static void fork_join(VM* vm, Task* tasks, int count, bool parallel) {
+    Fork fork = {.pending = count, .globals = vm->globals};
+    for (int i = 0; i < count; i++) {
+        tasks[i].fork = &fork;
+    }
+    if (!parallel || self == NULL || count == 1) {
+        for (int i = 0; i < count; i++) {
+            run_task(&tasks[i], vm);
+        }
+        return;
+    }
+
+    // a fiber can't move to another thread while its tasks are on this one's
+    // deque
+    async_pin();
+    int pushed = 0;
+    for (int i = 1; i < count; i++) {
+        if (push_task(&self->deque, &tasks[i])) {
+            pushed++;
+        } else {
+            run_task(&tasks[i], vm);
+        }
+    }
+    par_wake_workers();
+    run_task(&tasks[0], vm);
+    // whatever is left at the bottom of the deque is this fork's, since
+    // thieves take the tasks of enclosing forks before these
+    for (int i = 0; i < pushed; i++) {
+        Task* task = pop_task(&self->deque);
+        if (task == NULL) {
+            break;
+        }
+        run_task(task, vm);
+    }
+    while (atomic_load_explicit(&fork.pending, memory_order_acquire) > 0) {
+        Task* task = steal_any(self);
+        if (task != NULL) {
+            run_task(task, vm);
+        } else {
+            gc_safepoint();
+            sched_yield();
+        }
+    }
+    async_unpin();
+}
+
+static void run_branch(Task* task, VM* vm) {
+    Tuple* results = task->data;
+    // the fn is replaced by what it returns
+    results->values[task->start] =
+        vm_call(vm, results->values[task->start], NULL, 0);
+}
+
+/**
+ * @brief call the fns at fns, which take no args, in parallel, and put what
+ * they return in results, which has one value for each of them. Only threads
+ * in the pool run anything in parallel, the first one to call this starts it.
+ * Everywhere else, and if there is just one thread, the fns are called one
+ * after the other.
+ *
+ * @param vm the VM of the calling thread
+ * @param fns points into the stack of vm, which calling the fns may move
+ * @param results a tuple that is kept alive elsewhere
+ */
+void par_run(VM* vm, Val* fns, Tuple* results) {
+    int count = results->size;
+    if (count == 0) {
+        return;
+    }
+    memcpy(results->values, fns, sizeof(Val) * count);
+    Task tasks[count];
+    for (int i = 0; i < count; i++) {
+        tasks[i] = (Task){
+            .run = run_branch, .data = results, .start = i, .end = i + 1};
+    }
+    par_join_pool();
+    fork_join(vm, tasks, count, true);
+}
+
+/**
+ * @brief call fn with the argc values at args from C. Builtins read their
+ * args in place, and compiled C can't run on a stack that moves, so it is
+ * called above the top of the stack like aot_call expects.
+ */
+static Val call(VM* vm, Val fn, Val* args, int argc) {
+    if (is_builtin(fn)) {
+        return as_builtin(fn)(vm, args, argc);
+    }
+    if (!is_fn(fn) || as_fn(fn)->code->aot == NULL) {
+        return vm_call(vm, fn, args, argc);
+    }
+    Val* callee = vm->sp;
+    if (callee + argc + 1 > vm->stack_end) {
+        runtime_error("stack overflow");
+    }
+    callee[0] = fn;
+    memcpy(callee + 1, args, sizeof(Val) * argc);
+    vm->sp = callee + argc + 1;
+    Val result = aot_call(vm, callee, argc);
+    vm->sp = callee;
+    return result;
+}
+
+static void run_chunk(VM* vm, Bulk* bulk, int chunk) {
+    Val* values = bulk->input->values;
+    Val* out = bulk->out->values;
+    int start = chunk * bulk->chunk_size;
+    int end = start + bulk->chunk_size;
+    if (end > bulk->input->size) {
+        end = bulk->input->size;
+    }
+    switch (bulk->kind) {
+        case MapBulk:
+            for (int i = start; i < end; i++) {
+                out[i] = call(vm, bulk->fn, &values[i], 1);
+            }
+            break;
+        case FilterBulk:
+            for (int i = start; i < end; i++) {
+                out[i] = call(vm, bulk->fn, &values[i], 1);
+                if (!is_bool(out[i])) {
+                    runtime_error("pfilter expects a fn that returns a bool");
+                }
+            }
+            break;
+        case ReduceBulk:
+            out[chunk] = bulk->init;
+            for (int i = start; i < end; i++) {
+                Val args[2] = {out[chunk], values[i]};
+                out[chunk] = call(vm, bulk->fn, args, 2);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief run the chunks from start to end of the bulk operation task->data,
+ * by splitting them in half until one is left. A reduce combines the two
+ * halves' results once both are done, so results are combined as a tree,
+ * whose shape only depends on how many chunks there are.
+ */
+static void run_chunks(Task* task, VM* vm) {
+    Bulk* bulk = task->data;
+    if (task->end - task->start == 1) {
+        run_chunk(vm, bulk, task->start);
+        return;
+    }
+    int middle = task->start + (task->end - task->start) / 2;
+    Task halves[2] = {
+        {.run = run_chunks, .data = bulk, .start = task->start, .end = middle},
+        {.run = run_chunks, .data = bulk, .start = middle, .end = task->end}};
+    fork_join(vm, halves, 2, bulk->parallel);
+    if (bulk->kind == ReduceBulk) {
+        Val args[2] = {bulk->out->values[task->start],
+                       bulk->out->values[middle]};
+        bulk->out->values[task->start] = call(vm, bulk->fn, args, 2);
+    }
+}
+
+static void mark_bulk(void* roots) {
+    Bulk* bulk = roots;
+    gc_mark_val(bulk->fn);
+    gc_mark_val(bulk->init);
+    gc_mark_obj(&bulk->input->obj);
+    gc_mark_obj(&bulk->out->obj);
+}
+
+/**
+ * @brief how many values of a tuple of size values go in a chunk. Unless
+ * par_chunk_size fixes it, each thread gets a few chunks to even out their
+ * load, but tuples too small to be worth splitting are one chunk.
+ */
+static int chunk_size(int size) {
+    if (par_chunk_size > 0) {
+        return par_chunk_size;
+    }
+    int chunks = (self != NULL ? worker_count : 1) * CHUNKS_PER_WORKER;
+    int chunk = (size + chunks - 1) / chunks;
+    return chunk < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : chunk;
+}
+
+/**
+ * @brief run a bulk operation on a tuple that isn't empty, whose kind, fn,
+ * init and input are set. Compiled C only runs on the thread it started on,
+ * so the chunks of fns compiled to C are run one after the other.
+ */
+static void run_bulk(VM* vm, Bulk* bulk) {
+    par_join_pool();
+    int size = bulk->input->size;
+    bulk->chunk_size = chunk_size(size);
+    int chunks = (size + bulk->chunk_size - 1) / bulk->chunk_size;
+    bulk->out = as_tuple(new_tuple(bulk->kind == ReduceBulk ? chunks : size));
+    bulk->parallel = !is_fn(bulk->fn) || as_fn(bulk->fn)->code->aot == NULL;
+    gc_add_roots(mark_bulk, bulk);
+    Task all = {.run = run_chunks, .data = bulk, .start = 0, .end = chunks};
+    run_chunks(&all, vm);
+    gc_remove_roots(bulk);
+}
+
+/**
+ * @brief a tuple of what fn returns for each value of input
+ */
+Val par_map(VM* vm, Val fn, Tuple* input) {
+    if (input->size == 0) {
+        return new_tuple(0);
+    }
+    Bulk bulk = {.kind = MapBulk, .fn = fn, .init = VOID_VAL, .input = input};
+    run_bulk(vm, &bulk);
+    return obj_val(&bulk.out->obj);
+}
+
+/**
+ * @brief a tuple of the values of input that pred returns true for, in order
+ */
+Val par_filter(VM* vm, Val pred, Tuple* input) {
+    if (input->size == 0) {
+        return new_tuple(0);
+    }
+    Bulk bulk = {.kind = FilterBulk, .fn = pred, .init = VOID_VAL, .input = input};
+    run_bulk(vm, &bulk);
+    int count = 0;
+    for (int i = 0; i < input->size; i++) {
+        count += as_bool(bulk.out->values[i]);
+    }
+    Tuple* kept = as_tuple(new_tuple(count));
+    for (int i = 0, j = 0; i < input->size; i++) {
+        if (as_bool(bulk.out->values[i])) {
+            kept->values[j++] = input->values[i];
+        }
+    }
+    return obj_val(&kept->obj);
+}
+
+/**
+ * @brief combine init and the values of input with fn. Each chunk is reduced
+ * from init on, and then the results of the chunks are combined as a tree, so
+ * fn has to be associative, with init as its identity. The result only
+ * depends on how input is split into chunks, which par_chunk_size can fix.
+ */
+Val par_reduce(VM* vm, Val fn, Val init, Tuple* input) {
+    if (input->size == 0) {
+        return init;
+    }
+    Bulk bulk = {.kind = ReduceBulk, .fn = fn, .init = init, .input = input};
+    run_bulk(vm, &bulk);
+    return bulk.out->values[0];
+}
+
+// TESTS
+static Val run_string(char* program) {
+    // the pool only starts once, so these tests make sure it has threads
+    if (!started && par_threads == 0) {
+        par_threads = 4;
+    }
+    return run_source(program);
+}
+
+void test_par_results() {
+    char program[] = "(let t (par (+ 1 2) (* 3 4) (tuple 5)));"
+                     "(+ (nth t 0) (+ (nth t 1) (nth (nth t 2) 0)))";
+    assert(as_int(run_string(program)) == 20);
+    char one[] = "(nth (par 7) 0)";
+    assert(as_int(run_string(one)) == 7);
+}
+
+void test_par_nested() {
+    char program[] =
+        "(let fib (fn (n) (if (== n 0) 0 (if (== n 1) 1"
+        "    (let r (par (fib (- n 1)) (fib (- n 2))));"
+        "    (+ (nth r 0) (nth r 1))))));"
+        "(fib 20)";
+    assert(as_int(run_string(program)) == 6765);
+}
+
+void test_par_collects() {
+    // every pair is a tuple on the heap, since it's returned
+    char program[] =
+        "(let pair (fn (n) (tuple n n)));"
+        "(let sum (fn (n acc) (if (== n 0) acc"
+        "    (sum (- n 1) (+ acc (nth (pair n) 0))))));"
+        "(let r (par (sum 100000 0) (sum 100000 0) (sum 100000 0)));"
+        "(+ (nth r 0) (+ (nth r 1) (nth r 2)))";
+    size_t collections = gc_stats().collections;
+    assert(as_int(run_string(program)) == 3 * 5000050000l);
+    assert(gc_stats().collections > collections);
+}
+
+static Val eval_string(char* program, cvector_vector_type(LexicalBinding) * env) {
+    Val val = eval(parse_source(program), env);
+    gc_pin(val);
+    return val;
+}
+
+static Val numbers(int size) {
+    Val tuple = new_tuple(size);
+    for (int i = 0; i < size; i++) {
+        as_tuple(tuple)->values[i] = int_val(i);
+    }
+    gc_pin(tuple);
+    return tuple;
+}
+
+void test_par_bulk() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    VM vm = new_vm(&env);
+    gc_add_roots(mark_vm, &vm);
+    char square[] = "(fn (x) (* x x))";
+    char even[] = "(fn (x) (== (* (/ x 2) 2) x))";
+    char add[] = "(fn (a b) (+ a b))";
+    Tuple* input = as_tuple(numbers(10000));
+
+    Tuple* squares = as_tuple(par_map(&vm, eval_string(square, &env), input));
+    assert(squares->size == 10000);
+    for (int i = 0; i < 10000; i++) {
+        assert(as_int(squares->values[i]) == (long)i * i);
+    }
+    Tuple* evens = as_tuple(par_filter(&vm, eval_string(even, &env), input));
+    assert(evens->size == 5000);
+    for (int i = 0; i < 5000; i++) {
+        assert(as_int(evens->values[i]) == 2 * i);
+    }
+    Val sum = par_reduce(&vm, eval_string(add, &env), int_val(0), input);
+    assert(as_int(sum) == 49995000);
+    // builtins are called without going through the VM
+    sum = par_reduce(&vm, builtin_val(builtin_add), int_val(0), input);
+    assert(as_int(sum) == 49995000);
+    gc_remove_roots(&vm);
+    free_vm(&vm);
+
+    char program[] =
+        "(preduce + 0 (pmap (fn (x) (* x x)) (pfilter (fn (x) (== x 2))"
+        "    (tuple 1 2 3 2))))";
+    assert(as_int(run_string(program)) == 8);
+    char empty[] = "(preduce + 7 (pmap (fn (x) x) (tuple)))";
+    assert(as_int(run_string(empty)) == 7);
+}
+
+/**
+ * @brief what reducing values with - gives when it's split into chunks of
+ * chunk values, and combined like run_chunks does
+ */
+static long subtract_chunks(int size, int chunk, int first, int last) {
+    if (last - first == 1) {
+        long result = 0;
+        for (int i = first * chunk; i < size && i < (first + 1) * chunk; i++) {
+            result -= i;
+        }
+        return result;
+    }
+    int middle = first + (last - first) / 2;
+    return subtract_chunks(size, chunk, first, middle) -
+           subtract_chunks(size, chunk, middle, last);
+}
+
+void test_par_reduce_deterministic() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    VM vm = new_vm(&env);
+    gc_add_roots(mark_vm, &vm);
+    // - isn't associative, so the result shows how values were combined
+    par_chunk_size = 100;
+    Tuple* input = as_tuple(numbers(10007));
+    long expected = subtract_chunks(10007, 100, 0, 101);
+    for (int i = 0; i < 10; i++) {
+        Val result =
+            par_reduce(&vm, builtin_val(builtin_sub), int_val(0), input);
+        assert(as_int(result) == expected);
+    }
+    par_chunk_size = 0;
+    gc_remove_roots(&vm);
+    free_vm(&vm);
+}
@@ -0,0 +1,49 @@
+#ifndef SPORK_PAR_H_
+#define SPORK_PAR_H_
+#include "value.h"
+#include "vm.h"
+
+// how many tasks a worker can have waiting to be stolen. Forking past that
+// runs the task right away instead.
+#define DEQUE_CAPACITY 4096
+// pmap, pfilter and preduce split a tuple into this many chunks per thread,
+// of at least MIN_CHUNK_SIZE values each
+#define CHUNKS_PER_WORKER 4
+#define MIN_CHUNK_SIZE 128
+// how many times an idle worker looks for a task before going to sleep
+#define IDLE_ROUNDS 64
+// the most threads --threads can ask for
+#define MAX_THREADS 256
+
+/*
+ * (par e1 e2 ...) evaluates its expressions in parallel on a pool of worker
+ * threads, which starts the first time a par runs. Every worker has a VM of
+ * its own and a deque of tasks. A par pushes its tasks onto the deque of the
+ * thread running it, runs the first one itself, and then pops the rest back
+ * unless idle workers stole them from the other end first. While it waits for
+ * stolen tasks to finish, it runs tasks it steals in turn. pmap, pfilter and
+ * preduce split their tuple into chunks, and fork over halves of the chunks
+ * the same way.
+ */
+
+// the threads in the pool, counting the one that started it, unless
+// --threads says otherwise. 0 means one per core.
+extern int par_threads;
+// how many values each chunk of a tuple has, unless --chunk-size says
+// otherwise. 0 means it depends on the number of threads.
+extern int par_chunk_size;
+
+void par_join_pool();
+void par_wake_workers();
+void par_run(VM* vm, Val* fns, Tuple* results);
+Val par_map(VM* vm, Val fn, Tuple* input);
+Val par_filter(VM* vm, Val pred, Tuple* input);
+Val par_reduce(VM* vm, Val fn, Val init, Tuple* input);
+
+// TESTS
+void test_par_results();
+void test_par_nested();
+void test_par_collects();
+void test_par_bulk();
+void test_par_reduce_deterministic();
+#endif
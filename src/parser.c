@@ -1,5 +1,6 @@
 #include "parser.h"
 
+#include <assert.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -100,12 +101,88 @@ Atom parse_atom(char **text_ptr) {
         atom.type.literal = literal;
     } else {
         atom.kind = SymbolAtom;
-        atom.type.symbol = sdsdup(token);
+        atom.type.symbol = intern(token);
     }
     sdsfree(token);
     return atom;
 }
 
+typedef struct SpecialForm {
+    char *name;
+    FormKind form;
+    Symbol symbol;
+} SpecialForm;
+
+static SpecialForm special_forms[] = {{.name = "#", .form = CommentForm},
+                                      {.name = "let", .form = LetForm},
+                                      {.name = "fn", .form = FnForm},
+                                      {.name = "if", .form = IfForm},
+                                      {.name = "memo", .form = MemoForm},
+                                      {.name = "par", .form = ParForm},
+                                      {.name = "spawn", .form = SpawnForm}};
+
+/**
+ * @brief decide what kind of list expr is from its first element, so later
+ * passes can switch on it instead of comparing symbols.
+ *
+ * @param expr a list expression
+ * @return FormKind
+ */
+static FormKind get_form(Expression *expr) {
+    if (special_forms[0].symbol == NULL) {
+        for (int i = 0; i < ARRAY_LEN(special_forms); i++) {
+            special_forms[i].symbol = intern(special_forms[i].name);
+        }
+    }
+    if (cvector_size(expr->data.expr) == 0) {
+        return CallForm;
+    }
+    Expression *first = expr->data.expr[0];
+    if (first->atomic && first->data.atom.kind == SymbolAtom) {
+        for (int i = 0; i < ARRAY_LEN(special_forms); i++) {
+            if (special_forms[i].symbol == first->data.atom.type.symbol) {
+                return special_forms[i].form;
+            }
+        }
+    }
+    return CallForm;
+}
+
+static Expression *new_expr(bool atomic) {
+    Expression *expr = malloc(sizeof(Expression));
+    expr->atomic = atomic;
+    expr->chain = NULL;
+    expr->form = AtomForm;
+    expr->address = (Address){.kind = UnresolvedAddress};
+    expr->frame = (FrameLayout){.size = 0, .captures = NULL, .self = -1};
+    expr->scratch = false;
+    expr->int_args = false;
+    return expr;
+}
+
+/**
+ * @brief turn each expression that par or spawn evaluates into
+ * `(fn () expression)`, so the later passes treat it as the body of a
+ * function, which is what runs in parallel or on a fiber.
+ */
+static void wrap_in_fns(Expression *expr) {
+    for (int i = 1; i < cvector_size(expr->data.expr); i++) {
+        Expression *fn = new_expr(false);
+        fn->data.expr = NULL;
+        fn->form = FnForm;
+        Expression *name = new_expr(true);
+        name->data.atom.kind = SymbolAtom;
+        name->data.atom.type.symbol = intern("fn");
+        Expression *params = new_expr(false);
+        params->data.expr = NULL;
+        params->form = CallForm;
+        cvector_push_back(fn->data.expr, name);
+        cvector_push_back(fn->data.expr, params);
+        cvector_push_back(fn->data.expr, expr->data.expr[i]);
+        expr->data.expr[i] = fn;
+    }
+}
+
 /**
  * @brief parse an expression. An expresion is a list containing symbols and
  * other expressions, delimited by parenthesis.
@@ -123,14 +200,12 @@ Expression *parse_expr(char **text_ptr) {
         return NULL;
     }
 
-    Expression *expr = malloc(sizeof(Expression));
-    expr->atomic = *curr != '(';
+    Expression *expr = new_expr(*curr != '(');
     if (expr->atomic) {
         expr->data.atom = parse_atom(&curr);
     } else {
         curr++;
         expr->data.expr = NULL;
-        expr->chain = NULL;
         consume_whitespace(&curr);
         while (*curr != ')') {
             Expression* ex = parse_expr(&curr);
@@ -144,6 +219,13 @@ Expression *parse_expr(char **text_ptr) {
             }
         }
         curr++;
+        expr->form = get_form(expr);
+        if (expr->form == SpawnForm && cvector_size(expr->data.expr) != 2) {
+            syntax_error("spawn expects one expression");
+        }
+        if (expr->form == ParForm || expr->form == SpawnForm) {
+            wrap_in_fns(expr);
+        }
         consume_whitespace(&curr);
         if (*curr == ';') {
             curr++;
@@ -159,14 +241,13 @@ Expression *parse_expr(char **text_ptr) {
 }
 
 /**
- * @brief free the provided atom (literal or symbol)
+ * @brief free the provided atom. Symbols are interned, so only literals own
+ * memory.
  *
  * @param atom
  */
 static void free_atom(Atom atom) {
-    if (atom.kind == SymbolAtom) {
-        sdsfree(atom.type.symbol);
-    } else {
+    if (atom.kind == LiteralAtom) {
         free_literal(atom.type.literal);
     }
 }
@@ -185,4 +266,23 @@ void free_expr(Expression *expr) {
         }
     }
     free(expr);
-}
\ No newline at end of file
+}
+// TESTS
+void test_parse_forms() {
+    char program[] = "(let f (fn (x) (if x (# yes) (f x)))); (f 1)";
+    char *curr = program;
+    Expression *expr = parse_expr(&curr);
+    assert(expr->form == LetForm);
+    assert(expr->data.expr[1]->form == AtomForm);
+
+    Expression *fn = expr->data.expr[2];
+    assert(fn->form == FnForm);
+    assert(fn->data.expr[1]->form == CallForm);
+
+    Expression *if_expr = fn->data.expr[2];
+    assert(if_expr->form == IfForm);
+    assert(if_expr->data.expr[2]->form == CommentForm);
+    assert(if_expr->data.expr[3]->form == CallForm);
+    assert(expr->chain->form == CallForm);
+    free_expr(expr);
+}
@@ -6,9 +6,7 @@
 #include "../lib/cvector/cvector.h"
 #include "../lib/sds/sds.h"
 #include "literal.h"
-
-/// @brief a symbol is just a string
-typedef sds Symbol;
+#include "symbol.h"
 
 typedef enum AtomKind { SymbolAtom, LiteralAtom } AtomKind;
 
@@ -29,22 +27,83 @@ typedef struct Atom {
 
 typedef struct Expression Expression;
 
+/**
+ * @brief what kind of expression a list is, decided by the parser from its
+ * first element. Lists that don't start with the name of a special form are
+ * calls. Atoms are always AtomForm.
+ */
+typedef enum FormKind {
+    AtomForm,
+    CallForm,
+    LetForm,
+    FnForm,
+    IfForm,
+    MemoForm,
+    CommentForm,
+    ParForm,
+    SpawnForm
+} FormKind;
+
+typedef enum AddressKind {
+    UnresolvedAddress,
+    GlobalAddress,
+    LocalAddress,
+    CaptureAddress
+} AddressKind;
+
+/**
+ * @brief where the value of a symbol lives at runtime, filled in by the
+ * resolver. Globals are an index into the global environment, locals are a
+ * slot of the current frame, and captures are a value the current fn copied
+ * out of the frame it was created in.
+ */
+typedef struct Address {
+    AddressKind kind;
+    int slot;
+} Address;
+
 typedef union ExpressionData {
     Atom atom;
     cvector_vector_type(Expression *) expr;
 } ExpressionData;
 
+/**
+ * @brief the frame a call to a fn needs, filled in by the resolver. `captures`
+ * are the addresses (in the frame the fn is created in) of the variables from
+ * outside the fn that its body uses, which are copied into the fn when it is
+ * created. `self` is the index of the capture that is the fn itself, when the
+ * fn is bound by a let and calls itself, or -1.
+ */
+typedef struct FrameLayout {
+    int size;
+    cvector_vector_type(Address) captures;
+    int self;
+} FrameLayout;
+
 /**
  * @brief An Expression either contains a tuple of expressions or a single atom.
- * We can determine which by checking the 'atomic' flag.
+ * We can determine which by checking the 'atomic' flag, and what kind of list
+ * it is by checking `form`. `address` is set by the resolver on symbols, and
+ * `frame` on fn expressions. `scratch` is set on calls of tuple whose result
+ * can't outlive the call of the fn they are in (see scratch.h), and
+ * `int_args` on calls of the arithmetic builtins that the typechecker proved
+ * get two ints (see typechecker.h).
  */
 typedef struct Expression {
     ExpressionData data;
     Expression* chain;
     bool atomic;
+    FormKind form;
+    Address address;
+    FrameLayout frame;
+    bool scratch;
+    bool int_args;
 } Expression;
 
 void syntax_error(char *message);
 Expression *parse_expr(char **text_ptr);
 void free_expr(Expression *expr);
+
+// TESTS
+void test_parse_forms();
 #endif
\ No newline at end of file
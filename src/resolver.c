@@ -0,0 +1,353 @@
+#include "resolver.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "interpreter.h"
+#include "parser.h"
+#include "scratch.h"
+#include "utils.h"
+
+/**
+ * @brief a local variable that is visible at the current point of the
+ * program, and the slot of its frame that it is stored in.
+ */
+typedef struct Declaration {
+    Symbol symbol;
+    int slot;
+} Declaration;
+
+/**
+ * @brief the locals of a fn (or of the program itself, which has no parent)
+ * that are being resolved.
+ */
+typedef struct FnScope {
+    struct FnScope* parent;
+    cvector_vector_type(Declaration) visible;
+    FrameLayout frame;
+} FnScope;
+
+typedef struct Resolver {
+    cvector_vector_type(LexicalBinding) * env;
+    cvector_vector_type(bool) defined;
+    int unbound_symbols;
+} Resolver;
+
+static void resolve_expr(Resolver* resolver, FnScope* scope, Expression* expr);
+
+static Symbol get_as_symbol(Expression* expr) {
+    return (expr->atomic && expr->data.atom.kind == SymbolAtom)
+               ? expr->data.atom.type.symbol
+               : NULL;
+}
+
+static int find_global(Resolver* resolver, Symbol symbol) {
+    for (int i = cvector_size(*resolver->env) - 1; i >= 0; i--) {
+        if ((*resolver->env)[i].symbol == symbol) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Address declare(FnScope* scope, Symbol symbol) {
+    Declaration declaration = {.symbol = symbol, .slot = scope->frame.size++};
+    cvector_push_back(scope->visible, declaration);
+    return (Address){.kind = LocalAddress, .slot = declaration.slot};
+}
+
+/**
+ * @brief the index of the capture of frame that copies address, or -1 if
+ * there is none.
+ */
+static int find_capture(FrameLayout* frame, Address address) {
+    for (int i = 0; i < cvector_size(frame->captures); i++) {
+        if (frame->captures[i].kind == address.kind &&
+            frame->captures[i].slot == address.slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Address capture(FnScope* scope, Address outer) {
+    int capture = find_capture(&scope->frame, outer);
+    if (capture == -1) {
+        cvector_push_back(scope->frame.captures, outer);
+        capture = cvector_size(scope->frame.captures) - 1;
+    }
+    return (Address){.kind = CaptureAddress, .slot = capture};
+}
+
+/**
+ * @brief find the innermost local binding of symbol that is visible in scope.
+ * A binding from outside the fn of scope is captured by it, and by every fn in
+ * between, so that each of them can copy it out of the frame it is created in.
+ *
+ * @return bool whether a binding was found
+ */
+static bool find_local(FnScope* scope, Symbol symbol, Address* address) {
+    for (int i = cvector_size(scope->visible) - 1; i >= 0; i--) {
+        if (scope->visible[i].symbol == symbol) {
+            *address = (Address){.kind = LocalAddress,
+                                 .slot = scope->visible[i].slot};
+            return true;
+        }
+    }
+    Address outer;
+    if (scope->parent == NULL || !find_local(scope->parent, symbol, &outer)) {
+        return false;
+    }
+    *address = capture(scope, outer);
+    return true;
+}
+
+/**
+ * @brief find the innermost binding of the symbol in expr, and record its
+ * address on expr.
+ */
+static void resolve_symbol(Resolver* resolver, FnScope* scope,
+                           Expression* expr) {
+    Symbol symbol = expr->data.atom.type.symbol;
+    if (find_local(scope, symbol, &expr->address)) {
+        return;
+    }
+
+    // code outside of any fn runs in order, so it can only see the globals
+    // that have been defined already. Code inside a fn can see all of them.
+    int global = find_global(resolver, symbol);
+    bool in_fn = scope->parent != NULL;
+    if (global != -1 && (in_fn || resolver->defined[global])) {
+        expr->address = (Address){.kind = GlobalAddress, .slot = global};
+        return;
+    }
+    fprintf(stderr, "resolve error: symbol \"%s\" is not bound\n",
+            symbol->name);
+    resolver->unbound_symbols++;
+}
+
+/**
+ * @brief the fn that a let binds its variable to, if its value is one (or a
+ * memoized one), or NULL.
+ */
+static Expression* get_let_fn(Expression* value) {
+    if (value->form == MemoForm && cvector_size(value->data.expr) == 2) {
+        value = value->data.expr[1];
+    }
+    return value->form == FnForm ? value : NULL;
+}
+
+static void resolve_let(Resolver* resolver, FnScope* scope, Expression* expr) {
+    assert(cvector_size(expr->data.expr) == 3);
+    Expression* variable = expr->data.expr[1];
+    Expression* value = expr->data.expr[2];
+    assert(get_as_symbol(variable) != NULL);
+
+    // a fn can call itself through the variable it's bound to, so the
+    // variable is visible while resolving the fn. The variable isn't set until
+    // the fn has been created, so the fn captures itself instead of copying
+    // the variable. Any other value sees the previous binding of the variable
+    // (if there is one).
+    Expression* fn = get_let_fn(value);
+    if (fn != NULL) {
+        variable->address = declare(scope, variable->data.atom.type.symbol);
+        resolve_expr(resolver, scope, value);
+        fn->frame.self = find_capture(&fn->frame, variable->address);
+    } else {
+        resolve_expr(resolver, scope, value);
+        variable->address = declare(scope, variable->data.atom.type.symbol);
+    }
+}
+
+static void resolve_fn(Resolver* resolver, FnScope* scope, Expression* expr) {
+    assert(cvector_size(expr->data.expr) == 3);
+    assert(!expr->data.expr[1]->atomic);
+    FnScope fn_scope = {.parent = scope,
+                        .visible = NULL,
+                        .frame = {.size = 0, .captures = NULL, .self = -1}};
+    cvector_vector_type(Expression*) params = expr->data.expr[1]->data.expr;
+    for (int i = 0; i < cvector_size(params); i++) {
+        assert(get_as_symbol(params[i]) != NULL);
+        params[i]->address =
+            declare(&fn_scope, params[i]->data.atom.type.symbol);
+    }
+    resolve_expr(resolver, &fn_scope, expr->data.expr[2]);
+    expr->frame = fn_scope.frame;
+    cvector_free(fn_scope.visible);
+}
+
+/**
+ * @brief resolve a single expression, without the rest of its chain. Any
+ * variable declared by expr stays visible in the scope.
+ */
+static void resolve_node(Resolver* resolver, FnScope* scope, Expression* expr) {
+    switch (expr->form) {
+        case AtomForm:
+            if (expr->data.atom.kind == SymbolAtom) {
+                resolve_symbol(resolver, scope, expr);
+            }
+            break;
+        case CommentForm:
+            break;
+        case LetForm:
+            resolve_let(resolver, scope, expr);
+            break;
+        case FnForm:
+            resolve_fn(resolver, scope, expr);
+            break;
+        case MemoForm:
+            if (cvector_size(expr->data.expr) != 2 ||
+                expr->data.expr[1]->form != FnForm) {
+                syntax_error("memo expects a fn");
+            }
+            resolve_expr(resolver, scope, expr->data.expr[1]);
+            break;
+        case IfForm:
+            assert(cvector_size(expr->data.expr) == 4);
+            for (int i = 1; i < 4; i++) {
+                resolve_expr(resolver, scope, expr->data.expr[i]);
+            }
+            break;
+        case CallForm:
+            for (int i = 0; i < cvector_size(expr->data.expr); i++) {
+                resolve_expr(resolver, scope, expr->data.expr[i]);
+            }
+            break;
+        case ParForm:
+        case SpawnForm:
+            for (int i = 1; i < cvector_size(expr->data.expr); i++) {
+                resolve_expr(resolver, scope, expr->data.expr[i]);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief resolve expr and the rest of its chain. A variable declared by a let
+ * is visible until the end of the chain that the let is in.
+ */
+static void resolve_expr(Resolver* resolver, FnScope* scope, Expression* expr) {
+    int visible = cvector_size(scope->visible);
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        resolve_node(resolver, scope, curr);
+    }
+    cvector_set_size(scope->visible, visible);
+}
+
+static void add_global(Resolver* resolver, Symbol symbol, bool defined) {
+    if (find_global(resolver, symbol) == -1) {
+        LexicalBinding binding = {.symbol = symbol,
+                                  .boundValue = VOID_VAL};
+        cvector_push_back(*resolver->env, binding);
+        cvector_push_back(resolver->defined, defined);
+    }
+}
+
+/**
+ * @brief resolve every symbol in the program to the global or local slot it
+ * refers to, and abort if any of them are unbound. The lets in the top level
+ * chain of the program define globals, which are added to env. Everything else
+ * lives in a frame. Once resolved, the tuples that can't escape the frame that
+ * makes them are found (see scratch.c).
+ *
+ * @param program
+ * @param env the global environment
+ * @return FrameLayout the frame the program itself needs
+ */
+FrameLayout resolve(Expression* program,
+                    cvector_vector_type(LexicalBinding) * env) {
+    Resolver resolver = {.env = env, .defined = NULL, .unbound_symbols = 0};
+    for (int i = 0; i < cvector_size(*env); i++) {
+        cvector_push_back(resolver.defined, true);
+    }
+    for (Expression* curr = program; curr != NULL; curr = curr->chain) {
+        if (curr->form == LetForm) {
+            add_global(&resolver, get_as_symbol(curr->data.expr[1]), false);
+        }
+    }
+
+    FnScope scope = {.parent = NULL,
+                     .visible = NULL,
+                     .frame = {.size = 0, .captures = NULL, .self = -1}};
+    for (Expression* curr = program; curr != NULL; curr = curr->chain) {
+        if (curr->form != LetForm) {
+            resolve_node(&resolver, &scope, curr);
+            continue;
+        }
+        assert(cvector_size(curr->data.expr) == 3);
+        Expression* variable = curr->data.expr[1];
+        int global = find_global(&resolver, get_as_symbol(variable));
+        if (get_let_fn(curr->data.expr[2]) != NULL) {
+            resolver.defined[global] = true;
+        }
+        resolve_expr(&resolver, &scope, curr->data.expr[2]);
+        variable->address = (Address){.kind = GlobalAddress, .slot = global};
+        resolver.defined[global] = true;
+    }
+
+    cvector_free(scope.visible);
+    cvector_free(resolver.defined);
+    if (resolver.unbound_symbols > 0) {
+        abort();
+    }
+    find_scratch_tuples(program, scope.frame, *env);
+    return scope.frame;
+}
+
+// TESTS
+void test_resolve_locals() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    Expression* expr = parse_source("(fn (a b) (fn (c) (a c b)))");
+    FrameLayout program = resolve(expr, &env);
+    assert(program.size == 0 && cvector_size(program.captures) == 0);
+    assert(expr->frame.size == 2 && cvector_size(expr->frame.captures) == 0);
+
+    Expression* inner = expr->data.expr[2];
+    assert(inner->frame.size == 1);
+    Expression* a = inner->data.expr[2]->data.expr[0];
+    Expression* c = inner->data.expr[2]->data.expr[1];
+    Expression* b = inner->data.expr[2]->data.expr[2];
+    assert(a->address.kind == CaptureAddress && a->address.slot == 0);
+    assert(b->address.kind == CaptureAddress && b->address.slot == 1);
+    assert(c->address.kind == LocalAddress && c->address.slot == 0);
+    assert(cvector_size(inner->frame.captures) == 2);
+    assert(inner->frame.captures[0].kind == LocalAddress);
+    assert(inner->frame.captures[0].slot == 0);
+    assert(inner->frame.captures[1].slot == 1);
+}
+
+void test_resolve_captures() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    Expression* expr = parse_source(
+        "(fn (a) (let b a); (let f (fn () (fn () (f b)))); f)");
+    resolve(expr, &env);
+
+    // f only captures what its body uses, which includes what the fn inside
+    // of it uses, and it captures itself
+    Expression* let_f = expr->data.expr[2]->chain;
+    Expression* f = let_f->data.expr[2];
+    assert(cvector_size(f->frame.captures) == 2);
+    assert(f->frame.captures[0].kind == LocalAddress);
+    assert(f->frame.captures[0].slot == 2);
+    assert(f->frame.captures[1].slot == 1);
+    assert(f->frame.self == 0);
+
+    Expression* inner = f->data.expr[2];
+    assert(inner->frame.self == -1);
+    assert(inner->frame.captures[0].kind == CaptureAddress);
+    assert(inner->frame.captures[0].slot == 0);
+    assert(inner->frame.captures[1].slot == 1);
+}
+
+void test_resolve_globals() {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    cvector_push_back(env, ((LexicalBinding){.symbol = intern("g")}));
+    Expression* expr = parse_source("(let x (fn () (y))); (let y g); (x)");
+    assert(resolve(expr, &env).size == 0);
+    assert(cvector_size(env) == 3);
+
+    Expression* y = expr->data.expr[2]->data.expr[2]->data.expr[0];
+    assert(y->address.kind == GlobalAddress && y->address.slot == 2);
+    Expression* g = expr->chain->data.expr[2];
+    assert(g->address.kind == GlobalAddress && g->address.slot == 0);
+}
@@ -0,0 +1,14 @@
+#ifndef SPORK_RESOLVER_H_
+#define SPORK_RESOLVER_H_
+#include "../lib/cvector/cvector.h"
+#include "interpreter.h"
+#include "parser.h"
+
+FrameLayout resolve(Expression* program,
+                    cvector_vector_type(LexicalBinding) * env);
+
+// TESTS
+void test_resolve_locals();
+void test_resolve_globals();
+void test_resolve_captures();
+#endif
@@ -0,0 +1,266 @@
+#include "scratch.h"
+
+#include "builtins.h"
+#include "resolver.h"
+#include "utils.h"
+#include "value.h"
+
+/*
+ * Escape analysis for tuples. A tuple made by a call of tuple can live in the
+ * VM's scratch region instead of the heap (see ScratchTupleOp in vm.c) when
+ * nothing can see it once the call of the fn making it returns. That is the
+ * case when it is only ever read by nth: either it is the first arg of nth
+ * itself, or it is bound to a local that is only used as the first arg of nth,
+ * and that no fn captures.
+ */
+
+typedef struct Analysis {
+    cvector_vector_type(LexicalBinding) env;
+    // for each global, whether a let in the program binds it
+    cvector_vector_type(bool) rebound;
+    // for each local slot of the frame being analysed, whether its value can
+    // outlive the frame
+    cvector_vector_type(bool) escapes;
+} Analysis;
+
+static void analyse_frame(Analysis* analysis, Expression* body, int size);
+
+/**
+ * @brief whether expr is a call of the builtin fn, through a global that the
+ * program never rebinds.
+ */
+static bool is_builtin_call(Analysis* analysis, Expression* expr, BuiltinFn fn) {
+    if (expr->atomic || expr->form != CallForm ||
+        cvector_size(expr->data.expr) < 2) {
+        return false;
+    }
+    Expression* callee = expr->data.expr[0];
+    if (!callee->atomic || callee->chain != NULL ||
+        callee->address.kind != GlobalAddress) {
+        return false;
+    }
+    int slot = callee->address.slot;
+    return !analysis->rebound[slot] &&
+           analysis->env[slot].boundValue == builtin_val(fn);
+}
+
+/**
+ * @brief whether expr (without a chain) is a call of tuple, whose value is
+ * only what its args are.
+ */
+static bool is_tuple_call(Analysis* analysis, Expression* expr) {
+    return expr->chain == NULL && is_builtin_call(analysis, expr, builtin_tuple);
+}
+
+static void find_escapes(Analysis* analysis, Expression* expr);
+
+/**
+ * @brief a fn copies the locals it captures when it is created, so they
+ * escape with it. Its body runs in a frame of its own.
+ */
+static void find_fn_escapes(Analysis* analysis, Expression* fn) {
+    if (fn->form == MemoForm) {
+        fn = fn->data.expr[1];
+    }
+    for (int i = 0; i < cvector_size(fn->frame.captures); i++) {
+        Address address = fn->frame.captures[i];
+        if (address.kind == LocalAddress) {
+            analysis->escapes[address.slot] = true;
+        }
+    }
+}
+
+static void find_node_escapes(Analysis* analysis, Expression* expr) {
+    cvector_vector_type(Expression*) children = expr->data.expr;
+    switch (expr->form) {
+        case AtomForm:
+            if (expr->data.atom.kind == SymbolAtom &&
+                expr->address.kind == LocalAddress) {
+                analysis->escapes[expr->address.slot] = true;
+            }
+            break;
+        case CommentForm:
+            break;
+        case LetForm:
+            find_escapes(analysis, children[2]);
+            break;
+        case FnForm:
+        case MemoForm:
+            find_fn_escapes(analysis, expr);
+            break;
+        case IfForm:
+            for (int i = 1; i < 4; i++) {
+                find_escapes(analysis, children[i]);
+            }
+            break;
+        case CallForm:
+            for (int i = 0; i < cvector_size(children); i++) {
+                // nth only reads the tuple it's given
+                if (i == 1 && children[i]->atomic &&
+                    children[i]->chain == NULL &&
+                    is_builtin_call(analysis, expr, builtin_nth)) {
+                    continue;
+                }
+                find_escapes(analysis, children[i]);
+            }
+            break;
+        case ParForm:
+        case SpawnForm:
+            for (int i = 1; i < cvector_size(children); i++) {
+                find_fn_escapes(analysis, children[i]);
+            }
+            break;
+    }
+}
+
+/**
+ * @brief mark the local slots that the values of expr and the rest of its
+ * chain can escape through.
+ */
+static void find_escapes(Analysis* analysis, Expression* expr) {
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        find_node_escapes(analysis, curr);
+    }
+}
+
+static void mark_scratch(Analysis* analysis, Expression* expr);
+
+static void mark_node_scratch(Analysis* analysis, Expression* expr) {
+    cvector_vector_type(Expression*) children = expr->data.expr;
+    switch (expr->form) {
+        case AtomForm:
+        case CommentForm:
+            break;
+        case LetForm: {
+            Address address = children[1]->address;
+            if (address.kind == LocalAddress &&
+                !analysis->escapes[address.slot] &&
+                is_tuple_call(analysis, children[2])) {
+                children[2]->scratch = true;
+            }
+            mark_scratch(analysis, children[2]);
+            break;
+        }
+        case FnForm:
+            analyse_frame(analysis, children[2], expr->frame.size);
+            break;
+        case MemoForm:
+            mark_node_scratch(analysis, children[1]);
+            break;
+        case IfForm:
+            for (int i = 1; i < 4; i++) {
+                mark_scratch(analysis, children[i]);
+            }
+            break;
+        case CallForm:
+            if (is_builtin_call(analysis, expr, builtin_nth) &&
+                is_tuple_call(analysis, children[1])) {
+                children[1]->scratch = true;
+            }
+            for (int i = 0; i < cvector_size(children); i++) {
+                mark_scratch(analysis, children[i]);
+            }
+            break;
+        case ParForm:
+        case SpawnForm:
+            for (int i = 1; i < cvector_size(children); i++) {
+                mark_node_scratch(analysis, children[i]);
+            }
+            break;
+    }
+}
+
+static void mark_scratch(Analysis* analysis, Expression* expr) {
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        mark_node_scratch(analysis, curr);
+    }
+}
+
+/**
+ * @brief analyse the code running in a frame of size slots, and the bodies of
+ * the fns it creates in frames of their own.
+ */
+static void analyse_frame(Analysis* analysis, Expression* body, int size) {
+    cvector_vector_type(bool) outer = analysis->escapes;
+    analysis->escapes = NULL;
+    for (int i = 0; i < size; i++) {
+        cvector_push_back(analysis->escapes, false);
+    }
+    find_escapes(analysis, body);
+    mark_scratch(analysis, body);
+    cvector_free(analysis->escapes);
+    analysis->escapes = outer;
+}
+
+/**
+ * @brief set scratch on the calls of tuple in a resolved program whose tuple
+ * can't outlive the frame making it.
+ *
+ * @param program
+ * @param frame the frame the program itself runs in
+ * @param env the global environment the program was resolved in
+ */
+void find_scratch_tuples(Expression* program, FrameLayout frame,
+                         cvector_vector_type(LexicalBinding) env) {
+    Analysis analysis = {.env = env, .rebound = NULL, .escapes = NULL};
+    for (int i = 0; i < cvector_size(env); i++) {
+        cvector_push_back(analysis.rebound, false);
+    }
+    for (Expression* curr = program; curr != NULL; curr = curr->chain) {
+        if (curr->form == LetForm) {
+            analysis.rebound[curr->data.expr[1]->address.slot] = true;
+        }
+    }
+    analyse_frame(&analysis, program, frame.size);
+    cvector_free(analysis.rebound);
+}
+
+// TESTS
+static Expression* analyse_string(char* program) {
+    Expression* expr = parse_source(program);
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    resolve(expr, &env);
+    return expr;
+}
+
+/**
+ * @brief the value of the let that is the first expression in the body of
+ * the fn bound by the let expr.
+ */
+static Expression* first_let_value(Expression* expr) {
+    Expression* body = expr->data.expr[2]->data.expr[2];
+    return body->data.expr[2];
+}
+
+void test_scratch_let_tuples() {
+    Expression* expr = analyse_string(
+        "(let f (fn (a b) (let p (tuple a b)); (+ (nth p 0) (nth p 1))))");
+    assert(first_let_value(expr)->scratch);
+    expr = analyse_string("(let f (fn (a) (nth (tuple a a) 1)))");
+    Expression* nth = expr->data.expr[2]->data.expr[2];
+    assert(nth->data.expr[1]->scratch);
+}
+
+void test_scratch_escaping_tuples() {
+    // returned
+    Expression* expr =
+        analyse_string("(let f (fn (a) (let p (tuple a a)); p))");
+    assert(!first_let_value(expr)->scratch);
+    // passed to something other than nth
+    expr = analyse_string(
+        "(let f (fn (a) (let p (tuple a a)); (nth (tuple p) 0)))");
+    assert(!first_let_value(expr)->scratch);
+    // captured
+    expr = analyse_string(
+        "(let f (fn (a) (let p (tuple a a)); (fn () (nth p 0))))");
+    assert(!first_let_value(expr)->scratch);
+    // a global
+    expr = analyse_string("(let p (tuple 1 2)); (nth p 0)");
+    assert(!expr->data.expr[2]->scratch);
+    // nth isn't the builtin anymore
+    expr = analyse_string(
+        "(let nth (fn (t i) t));"
+        "(let f (fn (a) (let p (tuple a a)); (nth p 0)))");
+    assert(!first_let_value(expr->chain)->scratch);
+}
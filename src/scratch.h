@@ -0,0 +1,13 @@
+#ifndef SPORK_SCRATCH_H_
+#define SPORK_SCRATCH_H_
+#include "../lib/cvector/cvector.h"
+#include "interpreter.h"
+#include "parser.h"
+
+void find_scratch_tuples(Expression* program, FrameLayout frame,
+                         cvector_vector_type(LexicalBinding) env);
+
+// TESTS
+void test_scratch_let_tuples();
+void test_scratch_escaping_tuples();
+#endif
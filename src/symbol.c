@@ -0,0 +1,63 @@
+#include "symbol.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/hashmap/hashmap.h"
+
+static struct hashmap* symbol_table = NULL;
+
+static int symbol_compare(const void* a, const void* b, void* udata) {
+    Symbol const* symbol_a = a;
+    Symbol const* symbol_b = b;
+    return strcmp((*symbol_a)->name, (*symbol_b)->name);
+}
+
+static uint64_t symbol_hash(const void* item, uint64_t seed0, uint64_t seed1) {
+    Symbol const* symbol = item;
+    return (*symbol)->hash;
+}
+
+static uint64_t hash_name(const char* name) {
+    return hashmap_sip(name, strlen(name), 0, 0);
+}
+
+/**
+ * @brief return the canonical symbol for name, creating it the first time name
+ * is seen. The returned symbol lives for the rest of the program.
+ *
+ * @param name
+ * @return Symbol
+ */
+Symbol intern(const char* name) {
+    if (symbol_table == NULL) {
+        symbol_table = hashmap_new(sizeof(Symbol), 0, 0, 0, symbol_hash,
+                                   symbol_compare, NULL, NULL);
+    }
+
+    SymbolEntry key_entry = {.name = (sds)name, .hash = hash_name(name)};
+    Symbol key = &key_entry;
+    Symbol const* found = hashmap_get(symbol_table, &key);
+    if (found != NULL) {
+        return *found;
+    }
+
+    SymbolEntry* entry = malloc(sizeof(SymbolEntry));
+    *entry = (SymbolEntry){.name = sdsnew(name), .hash = key_entry.hash};
+    Symbol symbol = entry;
+    hashmap_set(symbol_table, &symbol);
+    return symbol;
+}
+
+// TESTS
+void test_intern() {
+    char name[] = "abc";
+    Symbol a = intern("abc");
+    Symbol b = intern(name);
+    assert(a == b);
+    assert(a->name != name);
+    assert(strcmp(a->name, "abc") == 0);
+    assert(a->hash == hash_name("abc"));
+    assert(intern("abd") != a);
+}
@@ -0,0 +1,24 @@
+#ifndef SPORK_SYMBOL_H_
+#define SPORK_SYMBOL_H_
+#include <stdint.h>
+
+#include "../lib/sds/sds.h"
+
+/**
+ * @brief the canonical copy of an identifier. There is exactly one SymbolEntry
+ * per distinct identifier, so two symbols are equal iff they are the same
+ * pointer, and their hash never has to be recomputed.
+ */
+typedef struct SymbolEntry {
+    sds name;
+    uint64_t hash;
+} SymbolEntry;
+
+/// @brief a symbol is an interned identifier
+typedef const SymbolEntry* Symbol;
+
+Symbol intern(const char* name);
+
+// TESTS
+void test_intern();
+#endif
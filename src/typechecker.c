@@ -1,16 +1,1043 @@
 #include "typechecker.h"
 
 #include <assert.h>
-#include <ctype.h>
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "../lib/hashmap/hashmap.h"
+#include "hamt.h"
 #include "parser.h"
 #include "utils.h"
 
+/*
+ * Hindley-Milner type inference. Every expression gets a type, and types that
+ * aren't known yet are variables that unification fills in. A let generalizes
+ * the variables that only its value uses, so a fn bound by a let can be called
+ * with args of different types. Variables remember how many lets deep they
+ * were made (their level), which tells which ones a let can generalize without
+ * scanning the environment.
+ */
 
-// every Expr has a Type (the Type of what it evaluates to)
-// (let x y) x
\ No newline at end of file
+/**
+ * @brief a call of nth on a tuple whose type wasn't known yet when it was
+ * checked. Once it is, the type of the index-th value of the tuple is unified
+ * with result, or the type of every value if index is NOT_LITERAL.
+ */
+typedef struct PendingNth {
+    Type* tuple;
+    long index;
+    Type* result;
+} PendingNth;
+
+#define NOT_LITERAL -1
+
+struct Checker {
+    int level;
+    int next_id;
+    int errors;
+    cvector_vector_type(PendingNth) pending;
+    // the calls of nth pending on generalized variables, which every
+    // instance of them gets a copy of (see generalize_let)
+    cvector_vector_type(PendingNth) generic_pending;
+    // how many lets in the top level chain bind each symbol
+    struct hashmap* global_lets;
+    // the types of the builtins, which calls are checked against
+    cvector_vector_type(DynamicEnvEntry) builtins;
+};
+
+typedef struct GlobalLets {
+    Symbol key;
+    int count;
+} GlobalLets;
+
+static int entry_compare(const void* a, const void* b, void* udata) {
+    const BaseEnvEntry* entry_a = a;
+    const BaseEnvEntry* entry_b = b;
+    return entry_a->key != entry_b->key;
+}
+
+static uint64_t entry_hash(const void* item, uint64_t seed0, uint64_t seed1) {
+    const BaseEnvEntry* entry = item;
+    return hashmap_sip(&entry->key, sizeof(Symbol), seed0, seed1);
+}
+
+static int global_lets_compare(const void* a, const void* b, void* udata) {
+    return ((const GlobalLets*)a)->key != ((const GlobalLets*)b)->key;
+}
+
+static uint64_t global_lets_hash(const void* item, uint64_t seed0,
+                                 uint64_t seed1) {
+    const GlobalLets* lets = item;
+    return hashmap_sip(&lets->key, sizeof(Symbol), seed0, seed1);
+}
+
+static Type* new_type(TypeKind kind) {
+    Type* type = malloc(sizeof(Type));
+    type->kind = kind;
+    return type;
+}
+
+static Type* lit(LiteralKind literal_kind) {
+    Type* literal = new_type(LitType);
+    literal->type.literal = literal_kind;
+    return literal;
+}
+
+static Type* new_var(Checker* checker) {
+    Type* var = new_type(VarType);
+    var->type.var = (Variable){
+        .instance = NULL, .level = checker->level, .id = checker->next_id++};
+    return var;
+}
+
+static Type* seq(Type* element) {
+    Type* type = new_type(SeqType);
+    type->type.element = element;
+    return type;
+}
+
+static Type* future(Type* element) {
+    Type* type = new_type(FutType);
+    type->type.element = element;
+    return type;
+}
+
+static TupleT* cons(Type* type, TupleT* next) {
+    TupleT* tuple = malloc(sizeof(TupleT));
+    *tuple = (TupleT){.next = next, .type = type};
+    return tuple;
+}
+
+static Type* construct_function_type(TupleT* args, Type* return_type) {
+    Type* func = new_type(FunType);
+    func->type.func = (Function){.args = args, .return_type = return_type};
+    return func;
+}
+
+/**
+ * @brief the type that type stands for: itself, unless it's a variable that
+ * has been unified with something.
+ */
+static Type* prune(Type* type) {
+    while (type->kind == VarType && type->type.var.instance != NULL) {
+        type = type->type.var.instance;
+    }
+    return type;
+}
+
+static sds cat_type(sds string, Type* type);
+
+static sds cat_tuple(sds string, TupleT* tuple) {
+    for (TupleT* curr = tuple; curr != NULL; curr = curr->next) {
+        string = cat_type(string, curr->type);
+        if (curr->next != NULL) {
+            string = sdscat(string, " ");
+        }
+    }
+    return string;
+}
+
+static sds cat_type(sds string, Type* type) {
+    type = prune(type);
+    switch (type->kind) {
+        case LitType:
+            switch (type->type.literal) {
+                case IntLit:
+                    return sdscat(string, "int");
+                case BoolLit:
+                    return sdscat(string, "bool");
+                case FloatLit:
+                    return sdscat(string, "float");
+                case StringLit:
+                    return sdscat(string, "string");
+                case InvalidLit:
+                    break;
+            }
+            abort();
+        case VoidType:
+            return sdscat(string, "void");
+        case VarType:
+            return sdscatprintf(string, "t%d", type->type.var.id);
+        case TupType:
+            string = sdscat(string, "(tuple");
+            if (type->type.tuple != NULL) {
+                string = sdscat(string, " ");
+            }
+            return sdscat(cat_tuple(string, type->type.tuple), ")");
+        case SeqType:
+            string = cat_type(sdscat(string, "(tuple "), type->type.element);
+            return sdscat(string, " ...)");
+        case FutType:
+            string = cat_type(sdscat(string, "(future "), type->type.element);
+            return sdscat(string, ")");
+        case FunType:
+            string = sdscat(string, "(fn (");
+            string = cat_tuple(string, type->type.func.args);
+            string = sdscat(string, ") ");
+            return sdscat(cat_type(string, type->type.func.return_type), ")");
+    }
+    abort();
+}
+
+/**
+ * @brief a readable version of type, which should be freed with sdsfree
+ */
+sds type_to_string(Type* type) { return cat_type(sdsempty(), type); }
+
+static void report(Checker* checker, char* message, Type* expected,
+                   Type* found) {
+    sds string = sdsnew(message);
+    if (expected != NULL) {
+        string = cat_type(sdscat(string, ": expected "), expected);
+        string = cat_type(sdscat(string, ", found "), found);
+    }
+    fprintf(stderr, "type error: %s\n", string);
+    sdsfree(string);
+    checker->errors++;
+}
+
+/**
+ * @brief whether var occurs in type. Every variable in type is moved up to the
+ * level of var on the way, since once they are unified, type can only be
+ * generalized where var can.
+ */
+static bool occurs(Type* var, Type* type) {
+    type = prune(type);
+    switch (type->kind) {
+        case VarType:
+            if (type == var) {
+                return true;
+            }
+            if (type->type.var.level > var->type.var.level) {
+                type->type.var.level = var->type.var.level;
+            }
+            return false;
+        case TupType:
+            for (TupleT* curr = type->type.tuple; curr; curr = curr->next) {
+                if (occurs(var, curr->type)) {
+                    return true;
+                }
+            }
+            return false;
+        case SeqType:
+        case FutType:
+            return occurs(var, type->type.element);
+        case FunType:
+            for (TupleT* curr = type->type.func.args; curr; curr = curr->next) {
+                if (occurs(var, curr->type)) {
+                    return true;
+                }
+            }
+            return occurs(var, type->type.func.return_type);
+        case LitType:
+        case VoidType:
+            return false;
+    }
+    abort();
+}
+
+static bool unify(Type* a, Type* b);
+
+static bool unify_tuples(TupleT* a, TupleT* b) {
+    while (a != NULL && b != NULL) {
+        if (!unify(a->type, b->type)) {
+            return false;
+        }
+        a = a->next;
+        b = b->next;
+    }
+    return a == NULL && b == NULL;
+}
+
+/**
+ * @brief make a and b the same type, by filling in the variables in them. A
+ * tuple and a SeqType only have to agree on the types of their values.
+ *
+ * @return bool whether they can be
+ */
+static bool unify(Type* a, Type* b) {
+    a = prune(a);
+    b = prune(b);
+    if (a == b) {
+        return true;
+    }
+    if (b->kind == VarType) {
+        Type* swap = a;
+        a = b;
+        b = swap;
+    }
+    if (a->kind == VarType) {
+        if (occurs(a, b)) {
+            return false;
+        }
+        a->type.var.instance = b;
+        return true;
+    }
+    if (b->kind == SeqType) {
+        Type* swap = a;
+        a = b;
+        b = swap;
+    }
+    if (a->kind == SeqType && b->kind == TupType) {
+        for (TupleT* curr = b->type.tuple; curr != NULL; curr = curr->next) {
+            if (!unify(a->type.element, curr->type)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+        case LitType:
+            return a->type.literal == b->type.literal;
+        case VoidType:
+            return true;
+        case TupType:
+            return unify_tuples(a->type.tuple, b->type.tuple);
+        case SeqType:
+        case FutType:
+            return unify(a->type.element, b->type.element);
+        case FunType:
+            return unify_tuples(a->type.func.args, b->type.func.args) &&
+                   unify(a->type.func.return_type, b->type.func.return_type);
+        case VarType:
+            break;
+    }
+    abort();
+}
+
+static void expect(Checker* checker, char* message, Type* expected,
+                   Type* found) {
+    if (!unify(expected, found)) {
+        report(checker, message, expected, found);
+    }
+}
+
+/**
+ * @brief generalize every variable in type that was made inside the let being
+ * left, which nothing outside of it can have constrained.
+ */
+static void generalize(Checker* checker, Type* type) {
+    type = prune(type);
+    switch (type->kind) {
+        case VarType:
+            if (type->type.var.level > checker->level) {
+                type->type.var.level = GENERIC_LEVEL;
+            }
+            break;
+        case TupType:
+            for (TupleT* curr = type->type.tuple; curr; curr = curr->next) {
+                generalize(checker, curr->type);
+            }
+            break;
+        case SeqType:
+        case FutType:
+            generalize(checker, type->type.element);
+            break;
+        case FunType:
+            for (TupleT* curr = type->type.func.args; curr; curr = curr->next) {
+                generalize(checker, curr->type);
+            }
+            generalize(checker, type->type.func.return_type);
+            break;
+        case LitType:
+        case VoidType:
+            break;
+    }
+}
+
+typedef struct Substitution {
+    Type* generic;
+    Type* fresh;
+} Substitution;
+
+static Type* instantiate_type(Checker* checker, Type* type,
+                              cvector_vector_type(Substitution) * subs);
+
+static TupleT* instantiate_tuple(Checker* checker, TupleT* tuple,
+                                 cvector_vector_type(Substitution) * subs) {
+    if (tuple == NULL) {
+        return NULL;
+    }
+    return cons(instantiate_type(checker, tuple->type, subs),
+                instantiate_tuple(checker, tuple->next, subs));
+}
+
+static Type* instantiate_type(Checker* checker, Type* type,
+                              cvector_vector_type(Substitution) * subs) {
+    type = prune(type);
+    switch (type->kind) {
+        case VarType:
+            if (type->type.var.level != GENERIC_LEVEL) {
+                return type;
+            }
+            for (int i = 0; i < cvector_size(*subs); i++) {
+                if ((*subs)[i].generic == type) {
+                    return (*subs)[i].fresh;
+                }
+            }
+            Substitution sub = {.generic = type, .fresh = new_var(checker)};
+            cvector_push_back(*subs, sub);
+            return sub.fresh;
+        case TupType: {
+            Type* tuple = new_type(TupType);
+            tuple->type.tuple = instantiate_tuple(checker, type->type.tuple, subs);
+            return tuple;
+        }
+        case SeqType:
+            return seq(instantiate_type(checker, type->type.element, subs));
+        case FutType:
+            return future(instantiate_type(checker, type->type.element, subs));
+        case FunType:
+            return construct_function_type(
+                instantiate_tuple(checker, type->type.func.args, subs),
+                instantiate_type(checker, type->type.func.return_type, subs));
+        case LitType:
+        case VoidType:
+            return type;
+    }
+    abort();
+}
+
+/**
+ * @brief a copy of type with a fresh variable for each generalized one. The
+ * calls of nth pending on the generalized variables are pending on the fresh
+ * ones too, and their results can hold other generalized variables in turn.
+ */
+static Type* instantiate(Checker* checker, Type* type) {
+    cvector_vector_type(Substitution) subs = NULL;
+    Type* instance = instantiate_type(checker, type, &subs);
+    for (int i = 0; i < cvector_size(subs); i++) {
+        for (int j = 0; j < cvector_size(checker->generic_pending); j++) {
+            PendingNth generic = checker->generic_pending[j];
+            if (generic.tuple != subs[i].generic) {
+                continue;
+            }
+            Type* tuple = subs[i].fresh;
+            Type* result = instantiate_type(checker, generic.result, &subs);
+            PendingNth pending = {
+                .tuple = tuple, .index = generic.index, .result = result};
+            cvector_push_back(checker->pending, pending);
+        }
+    }
+    cvector_free(subs);
+    return instance;
+}
+
+/**
+ * @brief unify the result of a call of nth with the values of the tuple it
+ * gets, if its type is known by now.
+ *
+ * @return bool whether it was
+ */
+static bool resolve_nth(Checker* checker, PendingNth pending) {
+    Type* tuple = prune(pending.tuple);
+    if (tuple->kind == VarType) {
+        return false;
+    }
+    if (tuple->kind == SeqType) {
+        expect(checker, "nth of a tuple", pending.result, tuple->type.element);
+    } else if (tuple->kind != TupType) {
+        report(checker, "nth expects a tuple", NULL, NULL);
+    } else if (pending.index == NOT_LITERAL) {
+        for (TupleT* curr = tuple->type.tuple; curr; curr = curr->next) {
+            expect(checker, "nth with an index that isn't a literal",
+                   pending.result, curr->type);
+        }
+    } else {
+        TupleT* curr = tuple->type.tuple;
+        for (long j = 0; curr != NULL && j < pending.index; j++) {
+            curr = curr->next;
+        }
+        if (curr == NULL) {
+            report(checker, "tuple index out of range", NULL, NULL);
+        } else {
+            expect(checker, "nth of a tuple", pending.result, curr->type);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief resolve the pending calls of nth whose tuples' types are known by
+ * now, and keep the rest pending.
+ */
+static void resolve_pending(Checker* checker) {
+    int kept = 0;
+    for (int i = 0; i < cvector_size(checker->pending); i++) {
+        if (!resolve_nth(checker, checker->pending[i])) {
+            checker->pending[kept++] = checker->pending[i];
+        }
+    }
+    cvector_set_size(checker->pending, kept);
+}
+
+/**
+ * @brief move the variables in the results of the calls of nth pending on a
+ * tuple from outside the let being left to the level of the tuple. A result
+ * is part of its tuple, so the let can't generalize it while the tuple is
+ * still to be resolved outside of it.
+ */
+static void hold_pending_results(Checker* checker) {
+    // the result of one call can be the tuple of another, so this goes on
+    // until no more tuples are found to be from outside
+    int held = -1;
+    int count = 0;
+    while (count != held) {
+        held = count;
+        count = 0;
+        for (int i = 0; i < cvector_size(checker->pending); i++) {
+            Type* tuple = prune(checker->pending[i].tuple);
+            if (tuple->kind == VarType &&
+                tuple->type.var.level <= checker->level) {
+                occurs(tuple, checker->pending[i].result);
+                count++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief generalize the type of the value of a let. A call of nth that is
+ * still pending on a variable the let generalizes can only be resolved for
+ * each use of the let's variable, so it's moved to generic_pending, and its
+ * result is generalized along with the tuple.
+ */
+static void generalize_let(Checker* checker, Type* type) {
+    hold_pending_results(checker);
+    generalize(checker, type);
+    // the result of one call can be the tuple of another
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        int kept = 0;
+        for (int i = 0; i < cvector_size(checker->pending); i++) {
+            PendingNth pending = checker->pending[i];
+            pending.tuple = prune(pending.tuple);
+            if (pending.tuple->kind == VarType &&
+                pending.tuple->type.var.level == GENERIC_LEVEL) {
+                generalize(checker, pending.result);
+                cvector_push_back(checker->generic_pending, pending);
+                moved = true;
+            } else {
+                checker->pending[kept++] = pending;
+            }
+        }
+        cvector_set_size(checker->pending, kept);
+    }
+}
+
+static void bind(Environment* env, Symbol symbol, Type* type) {
+    env->dynamic_env = hamt_set(env->dynamic_env, symbol, type);
+}
+
+static Type* lookup(Environment* env, Symbol symbol) {
+    return hamt_get(env->dynamic_env, symbol);
+}
+
+static TypeDeterminer lookup_determiner(Environment* env, Symbol symbol) {
+    if (lookup(env, symbol) != NULL) {
+        return NULL;
+    }
+    BaseEnvEntry* entry =
+        hashmap_get(env->base_env, &(BaseEnvEntry){.key = symbol});
+    return entry != NULL ? entry->value : NULL;
+}
+
+static Symbol get_as_symbol(Expression* expr) {
+    return (expr->atomic && expr->data.atom.kind == SymbolAtom)
+               ? expr->data.atom.type.symbol
+               : NULL;
+}
+
+static int global_let_count(Checker* checker, Symbol symbol) {
+    const GlobalLets* lets =
+        hashmap_get(checker->global_lets, &(GlobalLets){.key = symbol});
+    return lets != NULL ? lets->count : 0;
+}
+
+static Type* get_node_type(Checker* checker, Expression* expr,
+                           Environment* env);
+
+/**
+ * @brief the type of the value of a let, at one level deeper than the let. A
+ * fn can call itself through the variable it's bound to, so the variable is
+ * bound to a variable type while the fn is checked.
+ */
+static Type* get_let_value_type(Checker* checker, Expression* expr,
+                                Environment* env) {
+    Expression* variable = expr->data.expr[1];
+    Expression* value = expr->data.expr[2];
+    checker->level++;
+    Type* type;
+    if (value->form == MemoForm && cvector_size(value->data.expr) == 2) {
+        value = value->data.expr[1];
+    }
+    if (value->form == FnForm) {
+        Environment fn_env = *env;
+        Type* self = new_var(checker);
+        bind(&fn_env, get_as_symbol(variable), self);
+        type = get_type(checker, expr->data.expr[2], &fn_env);
+        expect(checker, "recursive fn", self, type);
+    } else {
+        type = get_type(checker, expr->data.expr[2], env);
+    }
+    checker->level--;
+    resolve_pending(checker);
+    return type;
+}
+
+/**
+ * @brief check a let of the top level chain, which binds a global. Fns that
+ * come earlier in the program can use the global too, so every global starts
+ * out bound to a variable type (see check_program). A global bound by only one let
+ * is generalized after it, one bound by more than one let keeps one type,
+ * since a fn made in between sees every value it's bound to.
+ */
+static void check_global_let(Checker* checker, Expression* expr,
+                             Environment* env) {
+    Symbol symbol = get_as_symbol(expr->data.expr[1]);
+    Type* global = lookup(env, symbol);
+    Type* type = get_let_value_type(checker, expr, env);
+    if (global_let_count(checker, symbol) > 1 || global->kind != VarType ||
+        global->type.var.level == GENERIC_LEVEL) {
+        expect(checker, "global bound twice", global, type);
+        return;
+    }
+    generalize_let(checker, type);
+    expect(checker, "global", global, instantiate(checker, type));
+    bind(env, symbol, type);
+}
+
+static Type* get_if_type(Checker* checker, Expression* expr,
+                         Environment* env) {
+    assert(cvector_size(expr->data.expr) == 4);
+    Type* condition = get_type(checker, expr->data.expr[1], env);
+    expect(checker, "condition of if", lit(BoolLit), condition);
+    Type* then_type = get_type(checker, expr->data.expr[2], env);
+    Type* else_type = get_type(checker, expr->data.expr[3], env);
+    expect(checker, "branches of if", then_type, else_type);
+    return then_type;
+}
+
+static Type* get_fn_type(Checker* checker, Expression* expr,
+                         Environment* env) {
+    assert(cvector_size(expr->data.expr) == 3);
+    Environment fn_env = *env;
+    cvector_vector_type(Expression*) params = expr->data.expr[1]->data.expr;
+    TupleT* args = NULL;
+    for (int i = cvector_size(params) - 1; i >= 0; i--) {
+        Type* param = new_var(checker);
+        bind(&fn_env, get_as_symbol(params[i]), param);
+        args = cons(param, args);
+    }
+    Type* return_type = get_type(checker, expr->data.expr[2], &fn_env);
+    return construct_function_type(args, return_type);
+}
+
+/**
+ * @brief whether the global arithmetic builtin a call is made through is
+ * always the builtin: it isn't shadowed, and the program never rebinds it.
+ */
+static bool calls_builtin(Checker* checker, Expression* callee,
+                          Environment* env) {
+    Symbol symbol = get_as_symbol(callee);
+    if (symbol == NULL || global_let_count(checker, symbol) > 0) {
+        return false;
+    }
+    Type* type = lookup(env, symbol);
+    for (int i = 0; i < cvector_size(checker->builtins); i++) {
+        if (checker->builtins[i].key == symbol) {
+            return checker->builtins[i].value == type;
+        }
+    }
+    return false;
+}
+
+static Type* get_call_type(Checker* checker, Expression* expr,
+                           Environment* env) {
+    if (cvector_size(expr->data.expr) == 0) {
+        syntax_error("cannot evaluate an empty expression");
+    }
+    Expression* callee = expr->data.expr[0];
+    Symbol symbol = get_as_symbol(callee);
+    TypeDeterminer determiner =
+        symbol != NULL ? lookup_determiner(env, symbol) : NULL;
+    if (determiner != NULL) {
+        return determiner(checker, expr, env);
+    }
+    Type* callee_type = get_type(checker, callee, env);
+    TupleT* args = NULL;
+    for (int i = cvector_size(expr->data.expr) - 1; i > 0; i--) {
+        args = cons(get_type(checker, expr->data.expr[i], env), args);
+    }
+    Type* return_type = new_var(checker);
+    expect(checker, "call", callee_type,
+           construct_function_type(args, return_type));
+    // the builtin's type only lets ints through
+    expr->int_args = calls_builtin(checker, callee, env);
+    return return_type;
+}
+
+static Type* get_tuple_type(Checker* checker, Expression* expr,
+                            Environment* env) {
+    TupleT* values = NULL;
+    for (int i = cvector_size(expr->data.expr) - 1; i > 0; i--) {
+        values = cons(get_type(checker, expr->data.expr[i], env), values);
+    }
+    Type* tuple = new_type(TupType);
+    tuple->type.tuple = values;
+    return tuple;
+}
+
+/**
+ * @brief the type of (nth tuple index). Tuples can hold values of different
+ * types, so the index has to be an int literal, unless every value has the
+ * same type. Until the type of the tuple is known, the call is pending.
+ */
+static Type* get_nth_type(Checker* checker, Expression* expr,
+                          Environment* env) {
+    if (cvector_size(expr->data.expr) != 3) {
+        report(checker, "nth expects a tuple and an int", NULL, NULL);
+        return new_var(checker);
+    }
+    Type* tuple = get_type(checker, expr->data.expr[1], env);
+    Expression* index = expr->data.expr[2];
+    expect(checker, "index of nth", lit(IntLit),
+           get_type(checker, index, env));
+    bool literal = index->atomic && index->chain == NULL &&
+                   index->data.atom.kind == LiteralAtom &&
+                   index->data.atom.type.literal.kind == IntLit;
+    PendingNth pending = {
+        .tuple = tuple,
+        .index = literal ? index->data.atom.type.literal.type.Int : NOT_LITERAL,
+        .result = new_var(checker)};
+    if (!resolve_nth(checker, pending)) {
+        cvector_push_back(checker->pending, pending);
+    }
+    return pending.result;
+}
+
+/**
+ * @brief the type of (par e1 e2 ...), which is the tuple of the types of the
+ * expressions. The parser makes each of them the body of a fn.
+ */
+static Type* get_par_type(Checker* checker, Expression* expr,
+                          Environment* env) {
+    TupleT* values = NULL;
+    for (int i = cvector_size(expr->data.expr) - 1; i > 0; i--) {
+        Type* fn = get_type(checker, expr->data.expr[i], env);
+        values = cons(fn->type.func.return_type, values);
+    }
+    Type* tuple = new_type(TupType);
+    tuple->type.tuple = values;
+    return tuple;
+}
+
+/**
+ * @brief the type of expr, leaving out its chain. A let binds its variable in
+ * env, which is the environment of the rest of the chain.
+ */
+static Type* get_node_type(Checker* checker, Expression* expr,
+                           Environment* env) {
+    switch (expr->form) {
+        case AtomForm:
+            if (expr->data.atom.kind == LiteralAtom) {
+                return lit(expr->data.atom.type.literal.kind);
+            } else {
+                Symbol symbol = expr->data.atom.type.symbol;
+                Type* type = lookup(env, symbol);
+                if (type == NULL) {
+                    sds message = sdscatprintf(
+                        sdsempty(), "\"%s\" can only be called", symbol->name);
+                    report(checker, message, NULL, NULL);
+                    sdsfree(message);
+                    return new_var(checker);
+                }
+                return instantiate(checker, type);
+            }
+        case CommentForm:
+            return new_type(VoidType);
+        case LetForm: {
+            assert(cvector_size(expr->data.expr) == 3);
+            Type* type = get_let_value_type(checker, expr, env);
+            generalize_let(checker, type);
+            bind(env, get_as_symbol(expr->data.expr[1]), type);
+            return new_type(VoidType);
+        }
+        case FnForm:
+            return get_fn_type(checker, expr, env);
+        case MemoForm:
+            return get_type(checker, expr->data.expr[1], env);
+        case IfForm:
+            return get_if_type(checker, expr, env);
+        case CallForm:
+            return get_call_type(checker, expr, env);
+        case ParForm:
+            return get_par_type(checker, expr, env);
+        case SpawnForm: {
+            // the parser made the expression the body of a fn
+            Type* fn = get_type(checker, expr->data.expr[1], env);
+            return future(fn->type.func.return_type);
+        }
+    }
+    abort();
+}
+
+/**
+ * @brief the type of the value of expr, which is the value of the last
+ * expression in its chain.
+ */
+Type* get_type(Checker* checker, Expression* expr, Environment* env) {
+    // the variables bound in the chain are visible in the rest of it only
+    Environment chain_env = *env;
+    Type* type = NULL;
+    for (Expression* curr = expr; curr != NULL; curr = curr->chain) {
+        type = get_node_type(checker, curr, &chain_env);
+    }
+    return type;
+}
+
+static Type* binary_int_op(Type* result) {
+    return construct_function_type(cons(lit(IntLit), cons(lit(IntLit), NULL)),
+                                   result);
+}
+
+static void add_builtin(Checker* checker, Environment* env, char* name,
+                        Type* type) {
+    DynamicEnvEntry entry = {.key = intern(name), .value = type};
+    cvector_push_back(checker->builtins, entry);
+    bind(env, entry.key, type);
+}
+
+/// @brief a variable that every use of the builtin that has it gets a copy of
+static Type* generic_var(Checker* checker) {
+    Type* var = new_var(checker);
+    var->type.var.level = GENERIC_LEVEL;
+    return var;
+}
+
+static Type* fn1(Type* arg, Type* result) {
+    return construct_function_type(cons(arg, NULL), result);
+}
+
+/**
+ * @brief the types of pmap, pfilter and preduce, which take a tuple of any
+ * length whose values all have the same type.
+ */
+static void add_bulk_builtins(Checker* checker, Environment* env) {
+    Type* a = generic_var(checker);
+    Type* b = generic_var(checker);
+    add_builtin(checker, env, "pmap",
+                construct_function_type(cons(fn1(a, b), cons(seq(a), NULL)),
+                                        seq(b)));
+    add_builtin(checker, env, "pfilter",
+                construct_function_type(
+                    cons(fn1(a, lit(BoolLit)), cons(seq(a), NULL)), seq(a)));
+    Type* combine = construct_function_type(cons(a, cons(a, NULL)), a);
+    add_builtin(checker, env, "preduce",
+                construct_function_type(
+                    cons(combine, cons(a, cons(seq(a), NULL))), a));
+}
+
+static Environment get_base_env(Checker* checker) {
+    Environment env = {
+        .base_env = hashmap_new(sizeof(BaseEnvEntry), 0, 0, 0, entry_hash,
+                                entry_compare, NULL, NULL),
+        .dynamic_env = NULL};
+    hashmap_set(env.base_env, &(BaseEnvEntry){.key = intern("tuple"),
+                                              .value = get_tuple_type});
+    hashmap_set(env.base_env,
+                &(BaseEnvEntry){.key = intern("nth"), .value = get_nth_type});
+
+    add_builtin(checker, &env, "+", binary_int_op(lit(IntLit)));
+    add_builtin(checker, &env, "-", binary_int_op(lit(IntLit)));
+    add_builtin(checker, &env, "*", binary_int_op(lit(IntLit)));
+    add_builtin(checker, &env, "/", binary_int_op(lit(IntLit)));
+    add_builtin(checker, &env, "==", binary_int_op(lit(BoolLit)));
+    add_builtin(checker, &env, "print",
+                construct_function_type(cons(lit(StringLit), NULL),
+                                        new_type(VoidType)));
+    add_bulk_builtins(checker, &env);
+    Type* value = generic_var(checker);
+    add_builtin(checker, &env, "await", fn1(future(value), value));
+    return env;
+}
+
+/**
+ * @brief infer the type of a resolved program.
+ *
+ * @return int the number of type errors found, which have been reported
+ */
+static int check_program(Expression* program) {
+    Checker checker = {.level = 0,
+                       .next_id = 0,
+                       .errors = 0,
+                       .pending = NULL,
+                       .generic_pending = NULL,
+                       .global_lets = hashmap_new(sizeof(GlobalLets), 0, 0, 0,
+                                                  global_lets_hash,
+                                                  global_lets_compare, NULL,
+                                                  NULL),
+                       .builtins = NULL};
+    Environment env = get_base_env(&checker);
+    for (Expression* curr = program; curr != NULL; curr = curr->chain) {
+        if (curr->form != LetForm) {
+            continue;
+        }
+        Symbol symbol = get_as_symbol(curr->data.expr[1]);
+        int count = global_let_count(&checker, symbol);
+        hashmap_set(checker.global_lets,
+                    &(GlobalLets){.key = symbol, .count = count + 1});
+        // a global that rebinds tuple or nth shadows its TypeDeterminer, so
+        // calls of it go by the type of what it's bound to
+        if (lookup(&env, symbol) == NULL) {
+            bind(&env, symbol, new_var(&checker));
+        }
+    }
+    // like in the resolver, the lets of the top level chain bind globals,
+    // and every other let is local
+    for (Expression* curr = program; curr != NULL; curr = curr->chain) {
+        if (curr->form == LetForm) {
+            check_global_let(&checker, curr, &env);
+        } else {
+            get_node_type(&checker, curr, &env);
+        }
+    }
+    // anything still pending after this gets a value no tuple ever flows
+    // into, like a param of a fn that is never called
+    resolve_pending(&checker);
+    hashmap_free(env.base_env);
+    hashmap_free(checker.global_lets);
+    cvector_free(checker.pending);
+    cvector_free(checker.generic_pending);
+    cvector_free(checker.builtins);
+    return checker.errors;
+}
+
+/**
+ * @brief check the types of a resolved program before it runs, and abort if
+ * they don't fit. Calls of the arithmetic builtins it proves get two ints are
+ * marked with int_args, for the compiler to specialize.
+ *
+ * @param program
+ */
+void typecheck(Expression* program) {
+    if (check_program(program) > 0) {
+        abort();
+    }
+}
+
+// TESTS
+static int count_type_errors(char* program) {
+    return check_program(parse_source(program));
+}
+
+void test_typecheck_infers() {
+    assert(count_type_errors("(* (+ 1 2) 5)") == 0);
+    assert(count_type_errors("(+ 1 \"a\")") == 1);
+    assert(count_type_errors("(if 1 2 3)") == 1);
+    assert(count_type_errors("(if true 2 \"a\")") == 1);
+    assert(count_type_errors("(let f (fn (a b) (+ a b))); (f 1 2 3)") == 1);
+    assert(count_type_errors("(let f (fn (a) (a 1))); (f 2)") == 1);
+    // fns can use globals that are bound later on
+    assert(count_type_errors(
+               "(let even (fn (n) (if (== n 0) true (odd (- n 1)))));"
+               "(let odd (fn (n) (if (== n 0) false (even (- n 1)))));"
+               "(even 10)") == 0);
+    assert(count_type_errors("(let x 1); (let f (fn () x)); (let x \"a\")") ==
+           1);
+    // only the lets of the top level chain are global
+    assert(count_type_errors("((fn () (let y 3); y))") == 0);
+    assert(count_type_errors("(pmap (fn (x) (let y (+ x 1)); y) (tuple 1 2))") ==
+           0);
+    assert(count_type_errors("(+ (nth (par (let a 1); a) 0) 1)") == 0);
+    assert(count_type_errors("(+ (await (spawn (let a 4); a)) 1)") == 0);
+    assert(count_type_errors("((fn () (let y 3); (+ y \"a\")))") == 1);
+    assert(count_type_errors("(let t (tuple 1 \"a\")); (+ (nth t 0) 1)") == 0);
+    assert(count_type_errors("(let t (tuple 1 \"a\")); (+ (nth t 1) 1)") == 1);
+    assert(count_type_errors("(let t (tuple 1 \"a\")); (nth t 2)") == 1);
+    assert(count_type_errors("(let f (fn (t i) (nth (tuple t t) i))); (f 1 0)") ==
+           0);
+    // the tuples the bulk builtins take and make can have any length
+    assert(count_type_errors(
+               "(let odd (pfilter (fn (x) (== (/ x 2) 0)) (tuple 1 2 3)));"
+               "(+ (nth odd 5) (preduce + 0 (pmap (fn (x) (* x x)) odd)))") ==
+           0);
+    assert(count_type_errors("(pmap (fn (x) (+ x 1)) (tuple 1 \"a\"))") == 1);
+    assert(count_type_errors("(pfilter (fn (x) x) (tuple 1 2))") == 1);
+    assert(count_type_errors("(let f (spawn (+ 1 2))); (* (await f) 2)") == 0);
+    assert(count_type_errors("(print (await (spawn 1)))") == 1);
+    assert(count_type_errors("(await 1)") == 1);
+}
+
+void test_typecheck_generalizes() {
+    assert(count_type_errors(
+               "(let id (fn (x) x)); (id 1); (print (id \"a\"))") == 0);
+    assert(count_type_errors(
+               "(let f (fn (a)"
+               "    (let pair (fn (x) (tuple x a)));"
+               "    (nth (pair true) 0)));"
+               "(if (f 1) (f \"a\") false)") == 0);
+    // nth of a param is checked for each call, against the tuple it gets
+    assert(count_type_errors("(let f (fn (t) (nth t 0))); 5") == 0);
+    assert(count_type_errors(
+               "(let f (fn (t) (nth t 0)));"
+               "(+ (f (tuple 1 \"a\")) (f (tuple 2)))") == 0);
+    assert(count_type_errors(
+               "(let f (fn (t) (nth t 0))); (+ (f (tuple \"a\" 1)) 1)") == 1);
+    assert(count_type_errors("(let f (fn (t) (nth t 2))); (f (tuple 1 2))") ==
+           1);
+    assert(count_type_errors(
+               "(let swap (fn (p) (tuple (nth p 1) (nth p 0))));"
+               "(+ (nth (swap (tuple \"a\" 1)) 0) 1)") == 0);
+    assert(count_type_errors(
+               "(let first (fn (t) (nth (nth t 0) 0)));"
+               "(+ (first (tuple (tuple 1 \"a\"))) 1)") == 0);
+    char sum[] =
+        "(let sum (fn (t n) (if (== n 0) 0"
+        "    (+ (nth t (- n 1)) (sum t (- n 1))))));";
+    assert(count_type_errors(sdscat(sdsnew(sum), "(sum (tuple 1 2 3) 3)")) ==
+           0);
+    assert(count_type_errors(sdscat(sdsnew(sum), "(sum (tuple 1 \"a\") 2)")) ==
+           1);
+    // nor can what nth of a param gives, until the param is resolved
+    assert(count_type_errors(
+               "(let f (fn (t) (let y (nth t 0)); (+ y 1))); (f (tuple \"a\"))") ==
+           1);
+    assert(count_type_errors(
+               "(let f (fn (t) (let y (nth (nth t 0) 1)); (+ y 1)));"
+               "(f (tuple (tuple 1 \"a\")))") == 1);
+    assert(count_type_errors(
+               "(let f (fn (t) (let y (nth t 0)); (+ y 1))); (f (tuple 2))") ==
+           0);
+    // a's type is only known once f is called, so it can't be generalized
+    assert(count_type_errors(
+               "(let f (fn (a) (let g (fn () a)); (+ (g) 1))); (f \"a\")") ==
+           1);
+}
+
+void test_typecheck_marks_int_args() {
+    Expression* expr = parse_source("(let f (fn (a) (+ a 1))); (f 2)");
+    assert(check_program(expr) == 0);
+    assert(expr->data.expr[2]->data.expr[2]->int_args);
+    assert(!expr->chain->int_args);
+    // rebinding a builtin whose calls have a type of their own makes it an
+    // ordinary global
+    assert(count_type_errors("(let nth (fn (t i) t)); (nth 1 2)") == 0);
+    assert(count_type_errors(
+               "(let tuple (fn (a b) (+ a b))); (* (tuple 1 2) 3)") == 0);
+    assert(count_type_errors("(let nth (fn (t i) t)); (+ (nth \"a\" 0) 1)") ==
+           1);
+    // calls through a rebound builtin aren't specialized
+    expr = parse_source("(let + (fn (a b) (- a b))); (+ 1 2)");
+    assert(check_program(expr) == 0);
+    assert(!expr->chain->int_args);
+    // and neither are calls of something shadowing it
+    expr = parse_source("(let f (fn (+) (+ 1 2)))");
+    assert(check_program(expr) == 0);
+    assert(!expr->data.expr[2]->data.expr[2]->int_args);
+}
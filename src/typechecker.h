@@ -4,12 +4,102 @@
 #include "parser.h"
 #include "../lib/hashmap/hashmap.h"
 #include "../lib/cvector/cvector.h"
+#include "hamt.h"
 
+// the level of type variables that are generalized, see generalize
+#define GENERIC_LEVEL 0x7fffffff
 
+typedef struct Type Type;
 
+/// @brief the types of the values of a tuple, or of the args of a function
+typedef struct TupleT TupleT;
+typedef struct TupleT {
+    TupleT* next;
+    Type* type;
+} TupleT;
 
+typedef struct Function {
+    TupleT* args;
+    Type* return_type;
+} Function;
 
+/**
+ * @brief a type that isn't known yet. Once unification finds out what it is,
+ * instance points to it. level is how many lets deep the variable was made,
+ * which decides whether a let can generalize it.
+ */
+typedef struct Variable {
+    Type* instance;
+    int level;
+    int id;
+} Variable;
 
+/**
+ * @brief a SeqType is a tuple whose length isn't known, and whose values all
+ * have the type element, like the tuples pfilter makes. Any tuple whose values
+ * have that type unifies with it. A FutType is a future whose value has the
+ * type element.
+ */
+typedef union TypeType {
+    TupleT* tuple;
+    LiteralKind literal;
+    Function func;
+    Variable var;
+    Type* element;
+} TypeType;
 
+typedef enum TypeKind {
+    TupType,
+    LitType,
+    FunType,
+    VoidType,
+    VarType,
+    SeqType,
+    FutType
+} TypeKind;
 
-#endif
\ No newline at end of file
+typedef struct Type {
+    TypeKind kind;
+    TypeType type;
+} Type;
+
+/**
+ * @brief what the variables in scope are bound to. base_env holds the builtins
+ * whose calls have a type of their own (see TypeDeterminer), and dynamic_env
+ * the type of everything else, which shadows base_env. dynamic_env is
+ * persistent, so a scope is extended by copying the Environment and binding
+ * in the copy, which leaves the enclosing scope as it was.
+ */
+typedef struct Environment {
+    struct hashmap* base_env;
+    Hamt* dynamic_env;
+} Environment;
+
+typedef struct Checker Checker;
+
+/**
+ * @brief the type of a call of a builtin that no single function type
+ * describes, like tuple, which takes any number of args of any type.
+ */
+typedef Type* (*TypeDeterminer)(Checker* checker, Expression* call,
+                                Environment* env);
+
+typedef struct BaseEnvEntry {
+    Symbol key;
+    TypeDeterminer value;
+} BaseEnvEntry;
+
+typedef struct DynamicEnvEntry {
+    Symbol key;
+    Type* value;
+} DynamicEnvEntry;
+
+Type* get_type(Checker* checker, Expression* expr, Environment* env);
+void typecheck(Expression* program);
+sds type_to_string(Type* type);
+
+// TESTS
+void test_typecheck_infers();
+void test_typecheck_generalizes();
+void test_typecheck_marks_int_args();
+#endif
@@ -2,13 +2,17 @@
 
 #include <execinfo.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "bigint.h"
+#include "builtins.h"
+#include "compiler.h"
 #include "escape.h"
 #include "interpreter.h"
 #include "literal.h"
 #include "parser.h"
-//#include "typechecker.h"
+#include "typechecker.h"
 
 /**
  * @brief read a file to a string if the file exists, otherwise, return NULL.
@@ -32,6 +36,33 @@ char *read_file_to_string(char *filename) {
     }
 }
 
+/**
+ * @brief parse program, which can be a string literal: the parser writes to
+ * the text it reads while it's at it, so it reads a copy.
+ *
+ * @param program
+ * @return Expression*
+ */
+Expression *parse_source(char *program) {
+    char *text = strdup(program);
+    char *curr = text;
+    Expression *expr = parse_expr(&curr);
+    free(text);
+    return expr;
+}
+
+/**
+ * @brief evaluate program with nothing but the builtins in scope
+ *
+ * @param program
+ * @return Val the value of program
+ */
+Val run_source(char *program) {
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    return eval(parse_source(program), &env);
+}
+
 /**
  * @brief print readable version of literal
  *
@@ -57,44 +88,73 @@ void print_literal(Literal literal) {
 
 void print_atom(Atom atom) {
     if (atom.kind == SymbolAtom) {
-        printf("%s", atom.type.symbol);
+        printf("%s", atom.type.symbol->name);
     } else {
         print_literal(atom.type.literal);
     }
 }
 
-void print_val(Val val) {
-    switch (val.kind) {
+static void print_val_inline(Val val) {
+    switch (val_kind(val)) {
         case BuiltinFnVal:;
-            char **symbols = backtrace_symbols(&val.type.bfn, 1);
+            void *bfn = (void *)as_builtin(val);
+            char **symbols = backtrace_symbols(&bfn, 1);
             printf("%s", *symbols);
             free(symbols);
             break;
-        case FnVal:
+        case FnVal:;
+            Code *code = as_fn(val)->code;
             printf("fn (");
-            for (int i = 0; i < cvector_size(val.type.fn.args); i++) {
-                printf(" %s", val.type.fn.args[i]);
+            for (int i = 0; i < cvector_size(code->params); i++) {
+                printf(" %s", code->params[i]->name);
             }
             printf(" ) ");
-            print_expr(val.type.fn.body);
+            if (code->body != NULL) {
+                print_expr(code->body);
+            } else {
+                // programs compiled to C don't keep their source
+                printf("...");
+            }
             break;
         case LiteralVal:
-            print_literal(val.type.lit);
+            if (is_bigint(val)) {
+                sds digits = bigint_to_string(val);
+                printf("%s", digits);
+                sdsfree(digits);
+                break;
+            }
+            print_literal(as_literal(val));
             break;
-        case TupleVal:
+        case TupleVal:;
+            Tuple *tuple = as_tuple(val);
             printf("(");
-            for (int i = 0; i < cvector_size(val.type.tup.values); i++) {
-                print_val(val.type.tup.values[i]);
-                if (i != cvector_size(val.type.tup.values) - 1) {
+            for (int i = 0; i < tuple->size; i++) {
+                print_val_inline(tuple->values[i]);
+                if (i != tuple->size - 1) {
                     printf(" ");
                 }
             }
             printf(")");
             break;
+        case FutureVal:
+            printf("future");
+            break;
         case VoidVal:
-            return;
+            break;
+    }
+}
+
+/**
+ * @brief print readable version of val, followed by a newline (unless val is
+ * void, which prints nothing)
+ *
+ * @param val
+ */
+void print_val(Val val) {
+    if (!is_void(val)) {
+        print_val_inline(val);
+        printf("\n");
     }
-    printf("\n");
 }
 
 /**
@@ -122,53 +182,11 @@ void print_expr(Expression *expr) {
  *
  * @param type
  */
-/*
 void print_type(Type *type) {
-    if (type == NULL) {
-        printf("NULL");
-        return;
-    }
-    if (type->kind == DefType) {
-        printf("%s", type->type.defined);
-    } else if (type->kind == LitType) {
-        char *type_str;
-        switch (type->type.literal) {
-            case IntLit:
-                type_str = "int";
-                break;
-            case BoolLit:
-                type_str = "bool";
-                break;
-            case FloatLit:
-                type_str = "float";
-                break;
-            case StringLit:
-                type_str = "string";
-                break;
-            case InvalidLit:
-                abort();
-        }
-        printf("%s", type_str);
-    } else if (type->kind == TupType) {
-        printf("(");
-        TupleT *curr = type->type.tuple;
-        while (curr != NULL) {
-            print_type(curr->type);
-            if (curr->next != NULL) {
-                printf(" ");
-            }
-            curr = curr->next;
-        }
-        printf(")");
-    } else if (type->kind == FunType) {
-    } else {
-        fprintf(stderr,
-                "trying to print out type that hasn't been implemented in "
-                "print_type()\n");
-        abort();
-    }
+    sds string = type_to_string(type);
+    printf("%s", string);
+    sdsfree(string);
 }
-*/
 
 /**
  * @brief return a new string that is the same as the old string except any
@@ -203,3 +221,23 @@ void syntax_error(char *message) {
     fprintf(stderr, "syntax error: %s\n", message);
     abort();
 }
+
+/**
+ * @brief crash with the provided message
+ *
+ * @param message
+ */
+void type_error(char *message) {
+    fprintf(stderr, "type error: %s\n", message);
+    abort();
+}
+
+/**
+ * @brief crash with the provided message
+ *
+ * @param message
+ */
+void runtime_error(char *message) {
+    fprintf(stderr, "runtime error: %s\n", message);
+    abort();
+}
@@ -0,0 +1,207 @@
+#include "value.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "gc.h"
+#include "literal.h"
+
+Val box_int(long i) {
+    BoxedInt* boxed = (BoxedInt*)gc_alloc(IntObj, sizeof(BoxedInt));
+    boxed->value = i;
+    return obj_val(&boxed->obj);
+}
+
+/**
+ * @brief make a string value. The value shares chars, it doesn't copy them,
+ * and they aren't freed with it.
+ *
+ * @param chars
+ * @return Val
+ */
+Val string_val(sds chars) {
+    String* string = (String*)gc_alloc(StringObj, sizeof(String));
+    string->chars = chars;
+    return obj_val(&string->obj);
+}
+
+/**
+ * @brief make a tuple with room for size values, all of which are void until
+ * the caller fills them in.
+ *
+ * @param size
+ * @return Val
+ */
+Val new_tuple(int size) {
+    Tuple* tuple = (Tuple*)gc_alloc(TupleObj, sizeof(Tuple) + sizeof(Val) * size);
+    tuple->size = size;
+    for (int i = 0; i < size; i++) {
+        tuple->values[i] = VOID_VAL;
+    }
+    return obj_val(&tuple->obj);
+}
+
+/**
+ * @brief make a function that runs code, with room for size captures, all of
+ * which are void until the caller fills them in.
+ *
+ * @param code
+ * @param size
+ * @return Val
+ */
+Val new_fn(Code* code, int size) {
+    Fn* fn = (Fn*)gc_alloc(FnObj, sizeof(Fn) + sizeof(Val) * size);
+    fn->code = code;
+    fn->memo = NULL;
+    fn->size = size;
+    for (int i = 0; i < size; i++) {
+        fn->captures[i] = VOID_VAL;
+    }
+    return obj_val(&fn->obj);
+}
+
+/**
+ * @brief make a future that isn't done yet, whose value is what fn returns.
+ * fn has to be kept alive elsewhere until the future holds it.
+ */
+Val new_future(Val fn) {
+    Future* future = (Future*)gc_alloc(FutureObj, sizeof(Future));
+    future->done = false;
+    future->fn = fn;
+    future->value = VOID_VAL;
+    future->waiters = NULL;
+    return obj_val(&future->obj);
+}
+
+ValKind val_kind(Val val) {
+    if (is_float(val)) {
+        return LiteralVal;
+    }
+    switch ((val & TAG_MASK) >> TAG_SHIFT & 0x7) {
+        case IntTag:
+        case BoolTag:
+            return LiteralVal;
+        case VoidTag:
+            return VoidVal;
+        case BuiltinTag:
+            return BuiltinFnVal;
+    }
+    switch (as_obj(val)->kind) {
+        case StringObj:
+        case IntObj:
+        case BigIntObj:
+            return LiteralVal;
+        case TupleObj:
+            return TupleVal;
+        case FnObj:
+            return FnVal;
+        case FutureObj:
+            return FutureVal;
+    }
+    abort();
+}
+
+/**
+ * @brief the kind of literal val is, or InvalidLit if it isn't a literal
+ *
+ * @param val
+ * @return LiteralKind
+ */
+LiteralKind literal_kind(Val val) {
+    if (is_float(val)) {
+        return FloatLit;
+    } else if (is_int(val)) {
+        return IntLit;
+    } else if (is_bool(val)) {
+        return BoolLit;
+    } else if (is_string(val)) {
+        return StringLit;
+    }
+    return InvalidLit;
+}
+
+/**
+ * @brief convert a parsed literal to a value. String values share the
+ * literal's chars.
+ *
+ * @param literal
+ * @return Val
+ */
+Val literal_val(Literal literal) {
+    switch (literal.kind) {
+        case IntLit:
+            return int_val(literal.type.Int);
+        case FloatLit:
+            return float_val(literal.type.Float);
+        case BoolLit:
+            return bool_val(literal.type.Bool);
+        case StringLit:
+            return string_val(literal.type.String);
+        case InvalidLit:
+            break;
+    }
+    abort();
+}
+
+Literal as_literal(Val val) {
+    Literal literal = {.kind = literal_kind(val)};
+    switch (literal.kind) {
+        case IntLit:
+            literal.type.Int = as_int(val);
+            break;
+        case FloatLit:
+            literal.type.Float = as_float(val);
+            break;
+        case BoolLit:
+            literal.type.Bool = as_bool(val);
+            break;
+        case StringLit:
+            literal.type.String = as_string(val);
+            break;
+        case InvalidLit:
+            break;
+    }
+    return literal;
+}
+
+// TESTS
+void test_int_vals() {
+    long ints[] = {0, 1, -1, SMALL_INT_MAX, SMALL_INT_MIN, SMALL_INT_MAX + 1,
+                   SMALL_INT_MIN - 1, 1l << 62, -(1l << 62)};
+    for (int i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+        Val val = int_val(ints[i]);
+        assert(is_int(val));
+        assert(!is_float(val));
+        assert(as_int(val) == ints[i]);
+        bool small = ints[i] >= SMALL_INT_MIN && ints[i] <= SMALL_INT_MAX;
+        assert(is_small_int(val) == small);
+    }
+}
+
+void test_float_vals() {
+    double floats[] = {0.0, -0.0, 1.5, -1.5, INFINITY, -INFINITY};
+    for (int i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+        Val val = float_val(floats[i]);
+        assert(is_float(val));
+        assert(as_float(val) == floats[i]);
+    }
+    Val nan = float_val(-NAN);
+    assert(is_float(nan));
+    assert(isnan(as_float(nan)));
+}
+
+void test_val_kinds() {
+    assert(sizeof(Val) == 8);
+    assert(val_kind(int_val(3)) == LiteralVal);
+    assert(literal_kind(int_val(3)) == IntLit);
+    assert(literal_kind(bool_val(true)) == BoolLit);
+    assert(as_bool(bool_val(true)) && !as_bool(bool_val(false)));
+    assert(literal_kind(float_val(3.0)) == FloatLit);
+    assert(literal_kind(string_val(sdsnew("abc"))) == StringLit);
+    assert(val_kind(VOID_VAL) == VoidVal);
+    assert(val_kind(new_tuple(2)) == TupleVal);
+    assert(literal_kind(new_tuple(2)) == InvalidLit);
+    assert(val_kind(new_fn(NULL, 0)) == FnVal);
+    assert(val_kind(new_future(VOID_VAL)) == FutureVal);
+}
@@ -0,0 +1,225 @@
+#ifndef SPORK_VALUE_H_
+#define SPORK_VALUE_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../lib/sds/sds.h"
+#include "literal.h"
+
+typedef struct Code Code;
+
+/**
+ * @brief a spork value, NaN-boxed into 8 bytes. Every double is stored as
+ * itself, except for NaNs with the sign and quiet bits set, which no float
+ * ever uses (NaNs are stored as one canonical positive NaN). Those encode a
+ * tag in bits 48-50 and a 48 bit payload: an int that fits in 48 bits, a bool,
+ * void, a builtin function pointer or a pointer to an object on the heap.
+ */
+typedef uint64_t Val;
+
+typedef enum ValKind {
+    LiteralVal,
+    TupleVal,
+    FnVal,
+    BuiltinFnVal,
+    FutureVal,
+    VoidVal
+} ValKind;
+
+struct VM;
+
+/**
+ * @brief a function implemented in C. Its args are read in place from the VM's
+ * stack, so they are only valid until the builtin returns, or until it calls
+ * spork code on vm (the VM running the call), which can move the stack.
+ */
+typedef Val (*BuiltinFn)(struct VM* vm, Val* args, int argc);
+
+typedef enum ObjKind {
+    StringObj,
+    IntObj,
+    BigIntObj,
+    TupleObj,
+    FnObj,
+    FutureObj
+} ObjKind;
+
+/**
+ * @brief the header of every object on the heap. The garbage collector links
+ * every object it allocated through next, and marks the ones still in use.
+ */
+typedef struct Obj {
+    ObjKind kind;
+    bool marked;
+    struct Obj* next;
+} Obj;
+
+typedef struct String {
+    Obj obj;
+    sds chars;
+} String;
+
+/// @brief an int that doesn't fit in the 48 bits of a boxed value
+typedef struct BoxedInt {
+    Obj obj;
+    long value;
+} BoxedInt;
+
+/**
+ * @brief an int that doesn't fit in a long (see bigint.c). digits are the
+ * base 2^32 digits of its absolute value, least significant first, and the
+ * most significant one is never 0.
+ */
+typedef struct BigInt {
+    Obj obj;
+    bool negative;
+    int size;
+    uint32_t digits[];
+} BigInt;
+
+typedef struct Tuple {
+    Obj obj;
+    int size;
+    Val values[];
+} Tuple;
+
+/**
+ * @brief a spork function. captures are copies of the variables from outside
+ * the function that its code uses, taken when the function was created. memo
+ * holds the results of its calls if it was created by a memo form, and is NULL
+ * otherwise.
+ */
+typedef struct Fn {
+    Obj obj;
+    Code* code;
+    struct Memo* memo;
+    int size;
+    Val captures[];
+} Fn;
+
+/**
+ * @brief what a spawn returns (see async.h). Until it's done, fn is the fn of
+ * no params that a fiber runs to compute its value, and waiters are the fibers
+ * that are waiting for it.
+ */
+typedef struct Future {
+    Obj obj;
+    _Atomic bool done;
+    Val fn;
+    Val value;
+    struct Fiber* waiters;
+} Future;
+
+typedef enum ValTag { IntTag = 1, BoolTag, VoidTag, BuiltinTag, ObjTag } ValTag;
+
+#define BOXED_BITS 0xfff8000000000000ull
+#define TAG_SHIFT 48
+#define TAG_MASK 0xffff000000000000ull
+#define PAYLOAD_MASK 0x0000ffffffffffffull
+#define TAG_BITS(tag) (BOXED_BITS | ((uint64_t)(tag) << TAG_SHIFT))
+#define CANONICAL_NAN 0x7ff8000000000000ull
+
+#define VOID_VAL TAG_BITS(VoidTag)
+#define FALSE_VAL TAG_BITS(BoolTag)
+#define TRUE_VAL (TAG_BITS(BoolTag) | 1)
+#define SMALL_INT_MIN (-(1l << 47))
+#define SMALL_INT_MAX ((1l << 47) - 1)
+
+static inline bool has_tag(Val val, ValTag tag) {
+    return (val & TAG_MASK) == TAG_BITS(tag);
+}
+
+static inline bool is_float(Val val) {
+    return (val & BOXED_BITS) != BOXED_BITS;
+}
+
+static inline double as_float(Val val) {
+    double d;
+    memcpy(&d, &val, sizeof(double));
+    return d;
+}
+
+static inline Val float_val(double d) {
+    Val val;
+    memcpy(&val, &d, sizeof(double));
+    return d != d ? CANONICAL_NAN : val;
+}
+
+static inline bool is_small_int(Val val) { return has_tag(val, IntTag); }
+
+static inline long as_small_int(Val val) {
+    // shift the payload up to the sign bit and back down to sign extend it
+    return ((int64_t)(val << 16)) >> 16;
+}
+
+static inline Val small_int_val(long i) {
+    return TAG_BITS(IntTag) | ((uint64_t)i & PAYLOAD_MASK);
+}
+
+static inline bool is_bool(Val val) { return has_tag(val, BoolTag); }
+static inline bool as_bool(Val val) { return val & 1; }
+static inline Val bool_val(bool b) { return b ? TRUE_VAL : FALSE_VAL; }
+
+static inline bool is_void(Val val) { return val == VOID_VAL; }
+
+static inline bool is_builtin(Val val) { return has_tag(val, BuiltinTag); }
+
+static inline BuiltinFn as_builtin(Val val) {
+    return (BuiltinFn)(uintptr_t)(val & PAYLOAD_MASK);
+}
+
+static inline Val builtin_val(BuiltinFn bfn) {
+    return TAG_BITS(BuiltinTag) | (uintptr_t)bfn;
+}
+
+static inline bool is_obj(Val val) { return has_tag(val, ObjTag); }
+static inline Obj* as_obj(Val val) { return (Obj*)(uintptr_t)(val & PAYLOAD_MASK); }
+static inline Val obj_val(Obj* obj) { return TAG_BITS(ObjTag) | (uintptr_t)obj; }
+
+static inline bool is_obj_kind(Val val, ObjKind kind) {
+    return is_obj(val) && as_obj(val)->kind == kind;
+}
+
+static inline bool is_int(Val val) {
+    return is_small_int(val) || is_obj_kind(val, IntObj);
+}
+
+static inline long as_int(Val val) {
+    return is_small_int(val) ? as_small_int(val)
+                             : ((BoxedInt*)as_obj(val))->value;
+}
+
+static inline bool is_bigint(Val val) { return is_obj_kind(val, BigIntObj); }
+static inline BigInt* as_bigint(Val val) { return (BigInt*)as_obj(val); }
+static inline bool is_string(Val val) { return is_obj_kind(val, StringObj); }
+static inline sds as_string(Val val) { return ((String*)as_obj(val))->chars; }
+static inline bool is_tuple(Val val) { return is_obj_kind(val, TupleObj); }
+static inline Tuple* as_tuple(Val val) { return (Tuple*)as_obj(val); }
+static inline bool is_fn(Val val) { return is_obj_kind(val, FnObj); }
+static inline Fn* as_fn(Val val) { return (Fn*)as_obj(val); }
+static inline bool is_future(Val val) { return is_obj_kind(val, FutureObj); }
+static inline Future* as_future(Val val) { return (Future*)as_obj(val); }
+
+Val box_int(long i);
+
+static inline Val int_val(long i) {
+    return (i >= SMALL_INT_MIN && i <= SMALL_INT_MAX) ? small_int_val(i)
+                                                      : box_int(i);
+}
+
+Val string_val(sds chars);
+Val new_tuple(int size);
+Val new_fn(Code* code, int size);
+Val new_future(Val fn);
+
+ValKind val_kind(Val val);
+LiteralKind literal_kind(Val val);
+Val literal_val(Literal literal);
+Literal as_literal(Val val);
+
+// TESTS
+void test_int_vals();
+void test_float_vals();
+void test_val_kinds();
+#endif
@@ -0,0 +1,813 @@
+#include "vm.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "async.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "compiler.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "memo.h"
+#include "par.h"
+#include "parser.h"
+#include "resolver.h"
+#include "utils.h"
+
+#define INITIAL_STACK_SIZE 1024
+// tuples that don't fit in the scratch region anymore go on the heap
+#define SCRATCH_SIZE (64 * 1024)
+// native code calls other native code through C, so this bounds how much of
+// the C stack it can use
+#define MAX_NATIVE_DEPTH 4096
+// builtins and tasks call back into the interpreter through C, so this
+// bounds how much of the C stack they can use
+#define MAX_RUN_DEPTH 2048
+
+size_t vm_max_stack = MAX_STACK_BYTES;
+
+static inline void push(VM* vm, Val val) { *vm->sp++ = val; }
+
+static inline Val pop(VM* vm) { return *--vm->sp; }
+
+/**
+ * @brief stop the program with a stack overflow if a stack with room for
+ * values values, and frames with room for frames frames, take up more than
+ * vm_max_stack bytes.
+ */
+static void check_stack_size(size_t values, size_t frames) {
+    if (values * sizeof(Val) + frames * sizeof(CallFrame) > vm_max_stack) {
+        runtime_error("stack overflow");
+    }
+}
+
+/**
+ * @brief make sure there is room for `needed` more values on the stack.
+ * Growing the stack moves it, so every frame that points into it is moved
+ * along with it.
+ */
+static void reserve_stack(VM* vm, int needed) {
+    if (vm->stack_end - vm->sp >= needed) {
+        return;
+    }
+    Val* old_stack = vm->stack;
+    size_t size = vm->sp - vm->stack;
+    size_t capacity = vm->stack_end - vm->stack;
+    while (capacity < size + needed) {
+        capacity *= 2;
+    }
+    check_stack_size(capacity, cvector_capacity(vm->frames));
+    vm->stack = realloc(vm->stack, sizeof(Val) * capacity);
+    if (vm->stack == NULL) {
+        runtime_error("stack overflow");
+    }
+    vm->stack_end = vm->stack + capacity;
+    vm->sp = vm->stack + size;
+    for (int i = 0; i < cvector_size(vm->frames); i++) {
+        CallFrame* frame = &vm->frames[i];
+        frame->base = vm->stack + (frame->base - old_stack);
+        frame->locals = vm->stack + (frame->locals - old_stack);
+    }
+}
+
+/**
+ * @brief start running code, whose argc args are at the top of the stack
+ * starting at locals. Its frame has to fit on the stack already.
+ *
+ * @param vm
+ * @param code
+ * @param base the stack is reset to here when the call returns
+ * @param locals
+ * @param argc
+ * @param fn the function being called
+ * @return CallFrame*
+ */
+static CallFrame* push_frame(VM* vm, Code* code, Val* base, Val* locals,
+                             int argc, Fn* fn) {
+    CallFrame frame = {.code = code,
+                       .ip = code->instructions,
+                       .base = base,
+                       .locals = locals,
+                       .fn = fn,
+                       .scratch = vm->scratch_top};
+    for (int i = argc; i < code->frame.size; i++) {
+        frame.locals[i] = VOID_VAL;
+    }
+    vm->sp = locals + code->frame.size;
+    size_t capacity = cvector_capacity(vm->frames);
+    if (cvector_size(vm->frames) == capacity) {
+        // the frames double like the stack does, instead of growing by one
+        capacity = capacity == 0 ? 1 : capacity * 2;
+        check_stack_size(vm->stack_end - vm->stack, capacity);
+        cvector_reserve(vm->frames, capacity);
+    }
+    cvector_push_back(vm->frames, frame);
+    return &vm->frames[cvector_size(vm->frames) - 1];
+}
+
+VM new_vm(cvector_vector_type(LexicalBinding) * globals) {
+    Val* stack = malloc(sizeof(Val) * INITIAL_STACK_SIZE);
+    Val* scratch = malloc(sizeof(Val) * SCRATCH_SIZE);
+    return (VM){.stack = stack,
+                .stack_end = stack + INITIAL_STACK_SIZE,
+                .sp = stack,
+                .scratch = scratch,
+                .scratch_end = scratch + SCRATCH_SIZE,
+                .scratch_top = scratch,
+                .frames = NULL,
+                .globals = globals,
+                .native_depth = 0,
+                .run_depth = 0};
+}
+
+/**
+ * @brief the number of values a tuple of size values takes up in the scratch
+ * region.
+ */
+static size_t scratch_slots(int size) {
+    return (sizeof(Tuple) + sizeof(Val) * size + sizeof(Val) - 1) / sizeof(Val);
+}
+
+/**
+ * @brief make a tuple of the argc values at args in the scratch region. It is
+ * never collected: it is released when the frame making it returns, and marked
+ * from the start, so that the collector leaves it to mark_vm to trace. If the
+ * region is full, the tuple goes on the heap like any other.
+ */
+static Val scratch_tuple(VM* vm, Val* args, int argc) {
+    size_t slots = scratch_slots(argc);
+    if (vm->scratch_end - vm->scratch_top < slots) {
+        return builtin_tuple(vm, args, argc);
+    }
+    Tuple* tuple = (Tuple*)vm->scratch_top;
+    vm->scratch_top += slots;
+    tuple->obj = (Obj){.kind = TupleObj, .marked = true, .next = NULL};
+    tuple->size = argc;
+    memcpy(tuple->values, args, sizeof(Val) * argc);
+    return obj_val(&tuple->obj);
+}
+
+/**
+ * @brief the roots of a running VM: every value on its stack or in a tuple in
+ * its scratch region, the functions its frames are running and its globals.
+ */
+void mark_vm(void* roots) {
+    VM* vm = roots;
+    for (Val* val = vm->stack; val < vm->sp; val++) {
+        gc_mark_val(*val);
+    }
+    for (Val* slot = vm->scratch; slot < vm->scratch_top;) {
+        Tuple* tuple = (Tuple*)slot;
+        for (int i = 0; i < tuple->size; i++) {
+            gc_mark_val(tuple->values[i]);
+        }
+        slot += scratch_slots(tuple->size);
+    }
+    for (int i = 0; i < cvector_size(vm->frames); i++) {
+        gc_mark_obj((Obj*)vm->frames[i].fn);
+    }
+    for (int i = 0; i < cvector_size(*vm->globals); i++) {
+        gc_mark_val((*vm->globals)[i].boundValue);
+    }
+}
+
+void free_vm(VM* vm) {
+    free(vm->stack);
+    free(vm->scratch);
+    cvector_free(vm->frames);
+}
+
+/**
+ * @brief call the builtin function at callee with the argc values above it,
+ * and replace all of them with its return value. The builtin reads its args
+ * straight off the stack.
+ */
+static void call_builtin(VM* vm, BuiltinFn bfn, Val* callee, int argc) {
+    size_t offset = callee - vm->stack;
+    Val result = bfn(vm, callee + 1, argc);
+    // builtins that call spork code, like pmap, can move the stack
+    vm->sp = vm->stack + offset;
+    push(vm, result);
+}
+
+static CallFrame* top_frame(VM* vm) {
+    return &vm->frames[cvector_size(vm->frames) - 1];
+}
+
+/**
+ * @brief run the call on top of the frames in native code, if its code has
+ * been JIT compiled (which happens once it has been called JIT_THRESHOLD
+ * times). If the native code hands the call back to the interpreter, the
+ * call's frame is set to continue where it left off.
+ *
+ * @param vm
+ * @return int the result of the native code (see jit.h), or 0 if the call has
+ * to be interpreted from the start.
+ */
+static int run_native(VM* vm) {
+    CallFrame* frame = top_frame(vm);
+    Code* code = frame->code;
+    NativeFn native = __atomic_load_n(&code->native, __ATOMIC_ACQUIRE);
+    if (native == NULL) {
+        // only the thread that makes the call that reaches the threshold
+        // compiles, when several threads call code at once (see par.h)
+        if (!jit_enabled ||
+            __atomic_add_fetch(&code->calls, 1, __ATOMIC_RELAXED) !=
+                JIT_THRESHOLD ||
+            !jit_compile(code)) {
+            return 0;
+        }
+        native = code->native;
+    }
+    if (vm->native_depth == MAX_NATIVE_DEPTH) {
+        return 0;
+    }
+    vm->native_depth++;
+    int result = native(vm, frame->locals, vm->sp, frame->fn);
+    vm->native_depth--;
+    if (result >= 0) {
+        // calls made by the native code may have moved the frames
+        frame = top_frame(vm);
+        frame->ip = frame->code->instructions + result;
+    }
+    return result;
+}
+
+/**
+ * @brief push a call of the value below the top argc values on the stack with
+ * them. Builtins are called right away instead.
+ *
+ * @param vm
+ * @param argc
+ * @return bool whether a frame was pushed for the call
+ */
+static bool push_call(VM* vm, int argc) {
+    if (gc_pending) {
+        gc_safepoint();
+    }
+    Val fn = vm->sp[-argc - 1];
+    if (is_builtin(fn)) {
+        call_builtin(vm, as_builtin(fn), vm->sp - argc - 1, argc);
+        return false;
+    } else if (!is_fn(fn)) {
+        runtime_error("trying to call a value that isn't a function");
+    }
+    Code* fn_code = as_fn(fn)->code;
+    if (argc != cvector_size(fn_code->params)) {
+        runtime_error("wrong number of arguments to function");
+    }
+    Val* callee = vm->sp - argc - 1;
+    Val result;
+    if (as_fn(fn)->memo != NULL &&
+        memo_get(as_fn(fn)->memo, callee + 1, argc, &result)) {
+        vm->sp = callee;
+        push(vm, result);
+        return false;
+    }
+    reserve_stack(vm, fn_code->frame.size + fn_code->max_stack);
+    callee = vm->sp - argc - 1;
+    push_frame(vm, fn_code, callee, callee + 1, argc, as_fn(fn));
+    return true;
+}
+
+/**
+ * @brief start the call that was just pushed, in native code if possible.
+ *
+ * @return CallFrame* the frame to continue interpreting in
+ */
+static CallFrame* start_call(VM* vm) {
+    if (run_native(vm) == JIT_RETURNED) {
+        // the return value is on top of the stack, and the code's last
+        // instruction returns it, which pops the frame the way vm_run expects
+        CallFrame* frame = top_frame(vm);
+        frame->ip = frame->code->instructions +
+                    cvector_size(frame->code->instructions) - 1;
+    }
+    return top_frame(vm);
+}
+
+/**
+ * @brief call the value below the top argc values on the stack with them.
+ *
+ * @param vm
+ * @param argc
+ * @return CallFrame* the frame to continue running in, which is the frame of
+ * the called function unless it is a builtin. Builtins like pmap call back
+ * into the VM, which can move the frames, so the caller's frame is looked up
+ * again.
+ */
+static CallFrame* call_value(VM* vm, int argc) {
+    return push_call(vm, argc) ? start_call(vm) : top_frame(vm);
+}
+
+/**
+ * @brief make a call for native code, from the top frame, which continues at
+ * instruction resume once the call returns.
+ *
+ * @param vm
+ * @param argc
+ * @param resume
+ * @return Val* the locals of the caller, if the call returned, or NULL if
+ * the interpreter has to finish it.
+ */
+Val* vm_jit_call(VM* vm, int argc, int resume) {
+    CallFrame* caller = top_frame(vm);
+    caller->ip = caller->code->instructions + resume;
+    if (push_call(vm, argc)) {
+        if (run_native(vm) != JIT_RETURNED) {
+            return NULL;
+        }
+        Val val = vm->sp[-1];
+        vm->sp = top_frame(vm)->base;
+        vm->scratch_top = top_frame(vm)->scratch;
+        cvector_pop_back(vm->frames);
+        push(vm, val);
+    }
+    return top_frame(vm)->locals;
+}
+
+/*
+ * The dispatch loop of vm_run. With threaded dispatch, every instruction ends
+ * by jumping straight to the code of the next one through targets, instead of
+ * going back to a single switch. Each jump then has its own entry in the
+ * branch predictor, which learns which instruction tends to follow which. The
+ * switch is still there for compilers without labels as values, where NEXT
+ * goes back to it.
+ */
+#ifdef THREADED_DISPATCH
+#define TARGET(op) \
+    case op:       \
+    op##Target:
+#define NEXT                                \
+    instruction = *frame->ip++;             \
+    goto* targets[instruction.op]
+#else
+#define TARGET(op) case op:
+#define NEXT break
+#endif
+
+/**
+ * @brief run the instruction for a call of a binary builtin (see BinaryOp in
+ * compiler.c). If both args are small ints, the global the call is made
+ * through is still bound to builtin and the ints x and y are valid args, the
+ * C expression result replaces them. Anything else calls the global on them,
+ * which the compiler left room for on the stack. Sums and differences of small
+ * ints always fit in a long, but their products may not (see int_mul).
+ */
+#define BINARY_OP(builtin, valid, result)                          \
+    {                                                              \
+        Val callee = globals[instruction.arg].boundValue;          \
+        Val a = vm->sp[-2];                                        \
+        Val b = vm->sp[-1];                                        \
+        if (callee == builtin_val(builtin) && is_small_int(a) &&   \
+            is_small_int(b)) {                                     \
+            long x = as_small_int(a);                              \
+            long y = as_small_int(b);                              \
+            if (valid) {                                           \
+                vm->sp--;                                          \
+                vm->sp[-1] = (result);                             \
+                NEXT;                                              \
+            }                                                      \
+        }                                                          \
+        vm->sp[0] = b;                                             \
+        vm->sp[-1] = a;                                            \
+        vm->sp[-2] = callee;                                       \
+        vm->sp++;                                                  \
+        frame = call_value(vm, 2);                                 \
+        NEXT;                                                      \
+    }
+
+/**
+ * @brief run the instruction for a call of a binary builtin that the
+ * typechecker proved is given two ints (see int_args in parser.h). There is no
+ * callee to check, and the ints only need a look at how they are represented:
+ * small ints x and y that are valid args are replaced with result, and any
+ * others by integer(a, b).
+ */
+#define INT_OP(integer, valid, result)                  \
+    {                                                   \
+        Val a = vm->sp[-2];                             \
+        Val b = vm->sp[-1];                             \
+        vm->sp--;                                       \
+        if (is_small_int(a) && is_small_int(b)) {       \
+            long x = as_small_int(a);                   \
+            long y = as_small_int(b);                   \
+            if (valid) {                                \
+                vm->sp[-1] = (result);                  \
+                NEXT;                                   \
+            }                                           \
+        }                                               \
+        vm->sp[-1] = integer(a, b);                     \
+        NEXT;                                           \
+    }
+
+/**
+ * @brief create a function running code in frame, copying the values it
+ * captures out of frame.
+ */
+static Val make_closure(CallFrame* frame, Code* code) {
+    int size = cvector_size(code->frame.captures);
+    Val val = new_fn(code, size);
+    Fn* fn = as_fn(val);
+    for (int i = 0; i < size; i++) {
+        Address capture = code->frame.captures[i];
+        fn->captures[i] = capture.kind == LocalAddress
+                              ? frame->locals[capture.slot]
+                              : frame->fn->captures[capture.slot];
+    }
+    // the variable a fn is bound to isn't set until after the fn is created
+    if (code->frame.self != -1) {
+        fn->captures[code->frame.self] = val;
+    }
+    if (code->memo) {
+        fn->memo = new_memo();
+    }
+    return val;
+}
+
+/**
+ * @brief run the top frame until it returns, leaving entry_frame frames, and
+ * return its value. Calls to spork functions don't recurse in C: they push a
+ * CallFrame and keep going in the same dispatch loop, and calls in tail
+ * position reuse the caller's frame. Calls are the safepoints where the
+ * garbage collector runs, since every live value is on the stack, in a frame
+ * or in a global there.
+ */
+static Val run(VM* vm, int entry_frame) {
+    LexicalBinding* globals = *vm->globals;
+    CallFrame* frame = top_frame(vm);
+#ifdef THREADED_DISPATCH
+    static void* targets[] = {
+        [ConstOp] = &&ConstOpTarget,
+        [LoadGlobalOp] = &&LoadGlobalOpTarget,
+        [StoreGlobalOp] = &&StoreGlobalOpTarget,
+        [LoadLocalOp] = &&LoadLocalOpTarget,
+        [StoreLocalOp] = &&StoreLocalOpTarget,
+        [LoadCaptureOp] = &&LoadCaptureOpTarget,
+        [FnOp] = &&FnOpTarget,
+        [CallOp] = &&CallOpTarget,
+        [TailCallOp] = &&TailCallOpTarget,
+        [ScratchTupleOp] = &&ScratchTupleOpTarget,
+        [ParOp] = &&ParOpTarget,
+        [SpawnOp] = &&SpawnOpTarget,
+        [AddOp] = &&AddOpTarget,
+        [SubOp] = &&SubOpTarget,
+        [MulOp] = &&MulOpTarget,
+        [DivOp] = &&DivOpTarget,
+        [EqOp] = &&EqOpTarget,
+        [AddIntOp] = &&AddIntOpTarget,
+        [SubIntOp] = &&SubIntOpTarget,
+        [MulIntOp] = &&MulIntOpTarget,
+        [DivIntOp] = &&DivIntOpTarget,
+        [EqIntOp] = &&EqIntOpTarget,
+        [JumpOp] = &&JumpOpTarget,
+        [JumpIfFalseOp] = &&JumpIfFalseOpTarget,
+        [PopOp] = &&PopOpTarget,
+        [VoidOp] = &&VoidOpTarget,
+        [ReturnOp] = &&ReturnOpTarget,
+    };
+#endif
+    Instruction instruction;
+    for (;;) {
+        instruction = *frame->ip++;
+#ifdef THREADED_DISPATCH
+        goto* targets[instruction.op];
+#endif
+        switch (instruction.op) {
+            TARGET(ConstOp)
+                push(vm, frame->code->constants[instruction.arg]);
+                NEXT;
+            TARGET(LoadGlobalOp)
+                push(vm, globals[instruction.arg].boundValue);
+                NEXT;
+            TARGET(StoreGlobalOp)
+                globals[instruction.arg].boundValue = pop(vm);
+                NEXT;
+            TARGET(LoadLocalOp)
+                push(vm, frame->locals[instruction.arg]);
+                NEXT;
+            TARGET(StoreLocalOp)
+                frame->locals[instruction.arg] = pop(vm);
+                NEXT;
+            TARGET(LoadCaptureOp)
+                push(vm, frame->fn->captures[instruction.arg]);
+                NEXT;
+            TARGET(FnOp) {
+                Code* fn_code = frame->code->functions[instruction.arg];
+                push(vm, make_closure(frame, fn_code));
+                NEXT;
+            }
+            TARGET(TailCallOp) {
+                if (gc_pending) {
+                    gc_safepoint();
+                }
+                int argc = instruction.arg;
+                Val fn = vm->sp[-argc - 1];
+                // a memoized fn stores its result (keyed by its args) when
+                // its frame returns, so that frame can't be taken over. Calls
+                // of one go through push_call, which looks the result up.
+                if (is_fn(fn) && as_fn(fn)->memo == NULL &&
+                    (frame->fn == NULL || frame->fn->memo == NULL)) {
+                    Code* fn_code = as_fn(fn)->code;
+                    if (argc != cvector_size(fn_code->params)) {
+                        runtime_error("wrong number of arguments to function");
+                    }
+                    reserve_stack(vm, fn_code->frame.size + fn_code->max_stack);
+                    // the caller is done, so the callee takes over its frame
+                    Val* callee = vm->sp - argc - 1;
+                    Val* base = frame->base;
+                    memmove(base, callee, sizeof(Val) * (argc + 1));
+                    vm->scratch_top = frame->scratch;
+                    cvector_pop_back(vm->frames);
+                    push_frame(vm, fn_code, base, base + 1, argc, as_fn(fn));
+                    frame = start_call(vm);
+                    NEXT;
+                }
+                // builtins don't have a frame to reuse (and neither do memoized
+                // fns), so they are called as usual and the ReturnOp after
+                // this returns their value.
+            }
+            TARGET(CallOp)
+                frame = call_value(vm, instruction.arg);
+                NEXT;
+            TARGET(ScratchTupleOp) {
+                // the escape analysis found that the tuple this makes dies
+                // with the frame, as long as the call is of the tuple builtin
+                int argc = instruction.arg;
+                Val* callee = vm->sp - argc - 1;
+                if (*callee != builtin_val(builtin_tuple)) {
+                    frame = call_value(vm, argc);
+                    NEXT;
+                }
+                Val tuple = scratch_tuple(vm, callee + 1, argc);
+                vm->sp = callee;
+                push(vm, tuple);
+                NEXT;
+            }
+            TARGET(ParOp) {
+                int count = instruction.arg;
+                // the results go in a tuple above the fns, which keeps it
+                // alive while they run
+                Val tuple = new_tuple(count);
+                push(vm, tuple);
+                par_run(vm, vm->sp - count - 1, as_tuple(tuple));
+                vm->sp -= count + 1;
+                push(vm, tuple);
+                frame = top_frame(vm);
+                NEXT;
+            }
+            TARGET(SpawnOp)
+                // the fn stays on the stack until its future holds it
+                vm->sp[-1] = async_spawn(vm, vm->sp[-1]);
+                NEXT;
+            TARGET(AddOp)
+                BINARY_OP(builtin_add, true, int_val(x + y))
+            TARGET(SubOp)
+                BINARY_OP(builtin_sub, true, int_val(x - y))
+            TARGET(MulOp)
+                BINARY_OP(builtin_mul, true, int_mul(x, y))
+            TARGET(DivOp)
+                BINARY_OP(builtin_div, y != 0, int_val(x / y))
+            TARGET(EqOp)
+                BINARY_OP(builtin_eq, true, bool_val(x == y))
+            TARGET(AddIntOp)
+                INT_OP(integer_add, true, int_val(x + y))
+            TARGET(SubIntOp)
+                INT_OP(integer_sub, true, int_val(x - y))
+            TARGET(MulIntOp)
+                INT_OP(integer_mul, true, int_mul(x, y))
+            TARGET(DivIntOp)
+                INT_OP(integer_div, y != 0, int_val(x / y))
+            TARGET(EqIntOp)
+                INT_OP(integer_eq, true, bool_val(x == y))
+            TARGET(JumpOp)
+                frame->ip = frame->code->instructions + instruction.arg;
+                NEXT;
+            TARGET(JumpIfFalseOp) {
+                Val condition = pop(vm);
+                if (!is_bool(condition)) {
+                    runtime_error("condition of if must be a bool");
+                }
+                if (!as_bool(condition)) {
+                    frame->ip = frame->code->instructions + instruction.arg;
+                }
+                NEXT;
+            }
+            TARGET(PopOp)
+                vm->sp--;
+                NEXT;
+            TARGET(VoidOp)
+                push(vm, VOID_VAL);
+                NEXT;
+            TARGET(ReturnOp) {
+                Val result = pop(vm);
+                vm->scratch_top = frame->scratch;
+                if (frame->fn != NULL && frame->fn->memo != NULL) {
+                    memo_set(frame->fn->memo, frame->locals,
+                             cvector_size(frame->code->params), result);
+                }
+                vm->sp = frame->base;
+                cvector_pop_back(vm->frames);
+                if (cvector_size(vm->frames) == entry_frame) {
+                    return result;
+                }
+                push(vm, result);
+                frame = &vm->frames[cvector_size(vm->frames) - 1];
+                NEXT;
+            }
+        }
+    }
+}
+
+/**
+ * @brief run code until it returns, and return its value.
+ *
+ * @param vm
+ * @param code
+ * @return Val
+ */
+Val vm_run(VM* vm, Code* code) {
+    int entry_frame = cvector_size(vm->frames);
+    if (entry_frame == 0) {
+        gc_add_roots(mark_vm, vm);
+    }
+    reserve_stack(vm, code->frame.size + code->max_stack);
+    push_frame(vm, code, vm->sp, vm->sp, 0, NULL);
+    Val result = run(vm, entry_frame);
+    if (entry_frame == 0) {
+        gc_remove_roots(vm);
+    }
+    return result;
+}
+
+/**
+ * @brief call fn with the argc values at args from C, on top of whatever vm is
+ * running, and return what it returns. Like any call, this is a safepoint.
+ * Every call from C nests another run of the interpreter on the C stack, so
+ * nesting them more than MAX_RUN_DEPTH deep is a stack overflow.
+ *
+ * @param vm
+ * @param fn
+ * @param args can't point into the stack of vm, which the call may move
+ * @param argc
+ * @return Val
+ */
+Val vm_call(VM* vm, Val fn, Val* args, int argc) {
+    if (vm->run_depth == MAX_RUN_DEPTH) {
+        runtime_error("stack overflow");
+    }
+    reserve_stack(vm, argc + 1);
+    push(vm, fn);
+    for (int i = 0; i < argc; i++) {
+        push(vm, args[i]);
+    }
+    int entry_frame = cvector_size(vm->frames);
+    if (!push_call(vm, argc)) {
+        return pop(vm);
+    }
+    start_call(vm);
+    vm->run_depth++;
+    Val result = run(vm, entry_frame);
+    vm->run_depth--;
+    return result;
+}
+
+// TESTS
+static bool has_int_value(Val val, long expected) {
+    return is_int(val) && as_int(val) == expected;
+}
+
+void test_vm_arithmetic() {
+    assert(has_int_value(run_source("(* (+ 1 2) 5)"), 15));
+    assert(has_int_value(run_source("(/ (- 10 4) 3)"), 2));
+}
+
+void test_vm_binary_ops() {
+    // ints too big to be small take the generic path
+    Val val = run_source("(- (+ 140737488355327 1) 1)");
+    assert(has_int_value(val, 140737488355327));
+    assert(is_bool(run_source("(== (+ 1 2) 3)")));
+    assert(as_bool(run_source("(== (+ 1 2) 3)")));
+
+    // results that don't fit in a long become bigints, and back again
+    val = run_source("(* 140737488355327 140737488355327)");
+    assert(is_bigint(val));
+    val = run_source(
+        "(let fact (fn (n) (if (== n 0) 1 (* n (fact (- n 1))))));"
+        "(/ (fact 30) (fact 28))");
+    assert(has_int_value(val, 870));
+
+    // the builtins can be rebound, and calls through them follow
+    val = run_source("(let + (fn (a b) (- a b))); (let f (fn () (+ 5 3))); (f)");
+    assert(has_int_value(val, 2));
+}
+
+void test_vm_recursion() {
+    Val val = run_source(
+        "(let x (fn (a b c d)"
+        "    (if (== a 0) b (x (- a c) (- b d) c d))));"
+        "(x 10 100 10 10)");
+    assert(has_int_value(val, 90));
+}
+
+void test_vm_chain() {
+    assert(has_int_value(run_source("(let x 5); (let z 10); (+ x z)"), 15));
+    assert(has_int_value(run_source("(# comment); (if true 1 2); 3"), 3));
+    assert(is_void(run_source("(let x 5)")));
+}
+
+void test_vm_tail_calls() {
+    char program[] =
+        "(let count (fn (n acc)"
+        "    (if (== n 0) acc (count (- n 1) (+ acc 1)))));"
+        "(count 1000000 0)";
+    cvector_vector_type(LexicalBinding) env = NULL;
+    add_builtins(&env);
+    Expression* expr = parse_source(program);
+    Code* code = compile(expr, resolve(expr, &env));
+
+    VM vm = new_vm(&env);
+    assert(has_int_value(vm_run(&vm, code), 1000000));
+    assert(cvector_capacity(vm.frames) <= 2);
+    assert(vm.stack_end - vm.stack == INITIAL_STACK_SIZE);
+    free_vm(&vm);
+}
+
+void test_vm_closures() {
+    Val val = run_source(
+        "(let make_adder (fn (n) (fn (x) (+ x n))));"
+        "(let add5 (make_adder 5));"
+        "(let f (fn (a)"
+        "    (let b (* a 2));"
+        "    (let g (fn (k) (if (== k 0) b (g (- k 1)))));"
+        "    (g 3)));"
+        "(+ (add5 10) (f 21))");
+    assert(has_int_value(val, 57));
+
+    // h calls g through the copy of g that g captured of itself
+    val = run_source(
+        "(let f (fn (n)"
+        "    (let g (fn (k)"
+        "        (if (== k 0) n (let h (fn () (g (- k 1)))); (h))));"
+        "    (g 3)));"
+        "(f 7)");
+    assert(has_int_value(val, 7));
+}
+
+void test_vm_scratch_tuples() {
+    // only f itself goes on the heap, p is made in the scratch region
+    size_t before = gc_stats().total_objects_allocated;
+    Val val = run_source(
+        "(let f (fn (a b) (let p (tuple a b)); (+ (nth p 0) (nth p 1))));"
+        "(+ (f 1 2) (f 3 4))");
+    assert(has_int_value(val, 10));
+    assert(gc_stats().total_objects_allocated - before == 1);
+
+    // a tuple that is returned goes on the heap
+    before = gc_stats().total_objects_allocated;
+    val = run_source(
+        "(let f (fn (a) (let p (tuple a (+ a 1))); p));"
+        "(nth (f 1) 1)");
+    assert(has_int_value(val, 2));
+    assert(gc_stats().total_objects_allocated - before == 2);
+}
+
+/**
+ * @brief whether running program with vm_max_stack set to max_stack stops it
+ * with an error (which aborts) rather than crashing. It runs in a child
+ * process, so the test can carry on either way.
+ */
+static bool overflows_cleanly(char* program, size_t max_stack) {
+    pid_t child = fork();
+    if (child == 0) {
+        vm_max_stack = max_stack;
+        freopen("/dev/null", "w", stderr);
+        run_source(program);
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+void test_vm_stack_overflow() {
+    // far deeper than the C stack would allow
+    char deep[] = "(let f (fn (n) (if (== n 0) 0 (+ 1 (f (- n 1))))));"
+                  "(f 1000000)";
+    assert(has_int_value(run_source(deep), 1000000));
+    assert(overflows_cleanly(deep, 1024 * 1024));
+    // every level calls back into the VM from pmap, through C
+    char nested[] =
+        "(let f (fn (n) (if (== n 0) 0 (+ 1 (nth (pmap f (tuple (- n 1))) 0)))));"
+        "(f 1000)";
+    assert(has_int_value(run_source(nested), 1000));
+    char too_nested[] =
+        "(let f (fn (n) (if (== n 0) 0 (+ 1 (nth (pmap f (tuple (- n 1))) 0)))));"
+        "(f 100000)";
+    assert(overflows_cleanly(too_nested, MAX_STACK_BYTES));
+}
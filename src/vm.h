@@ -0,0 +1,78 @@
+#ifndef SPORK_VM_H_
+#define SPORK_VM_H_
+#include "../lib/cvector/cvector.h"
+#include "compiler.h"
+#include "interpreter.h"
+
+// the VM dispatches instructions through computed gotos (labels as values)
+// where the compiler has them, unless SPORK_SWITCH_DISPATCH is defined
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SPORK_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#define VM_DISPATCH "threaded"
+#else
+#define VM_DISPATCH "switch"
+#endif
+
+// how many bytes the stack and the frames of a VM may take up together,
+// unless --max-stack says otherwise
+#define MAX_STACK_BYTES (1024l * 1024 * 1024)
+
+/**
+ * @brief a function call that is in progress. base is where the call starts on
+ * the VM's stack, and everything above it is released when the call returns.
+ * The locals of the call live on the stack right above the called function,
+ * and fn holds its captures (it is NULL while running the program itself).
+ * Likewise, everything the call puts in the scratch region goes above scratch.
+ */
+typedef struct CallFrame {
+    Code* code;
+    Instruction* ip;
+    Val* base;
+    Val* locals;
+    Fn* fn;
+    Val* scratch;
+} CallFrame;
+
+/**
+ * @brief the stack is one contiguous block of values, sp points one past the
+ * top value. It only grows when a call needs more room than it has left, and
+ * along with the frames, it lives on the heap, so recursion can go as deep as
+ * vm_max_stack allows. native_depth counts the calls running in native code
+ * that are nested in C, and run_depth the runs of the interpreter that are
+ * nested in C, by builtins and tasks that call back into it.
+ * The scratch region holds the tuples that the escape analysis proved die
+ * with the call that made them, and is released along with the call's frame.
+ * Unlike the stack, it never moves, so it can hold objects.
+ */
+typedef struct VM {
+    Val* stack;
+    Val* stack_end;
+    Val* sp;
+    Val* scratch;
+    Val* scratch_end;
+    Val* scratch_top;
+    cvector_vector_type(CallFrame) frames;
+    cvector_vector_type(LexicalBinding) * globals;
+    int native_depth;
+    int run_depth;
+} VM;
+
+extern size_t vm_max_stack;
+
+VM new_vm(cvector_vector_type(LexicalBinding) * globals);
+void free_vm(VM* vm);
+void mark_vm(void* roots);
+Val vm_run(VM* vm, Code* code);
+Val vm_call(VM* vm, Val fn, Val* args, int argc);
+Val* vm_jit_call(VM* vm, int argc, int resume);
+
+// TESTS
+void test_vm_arithmetic();
+void test_vm_binary_ops();
+void test_vm_recursion();
+void test_vm_chain();
+void test_vm_tail_calls();
+void test_vm_closures();
+void test_vm_scratch_tuples();
+void test_vm_stack_overflow();
+#endif
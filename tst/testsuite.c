@@ -1,6 +1,23 @@
 #include <stdio.h>
+#include "../src/aot.h"
+#include "../src/async.h"
+#include "../src/bigint.h"
+#include "../src/compiler.h"
 #include "../src/escape.h"
+#include "../src/gc.h"
+#include "../src/hamt.h"
+#include "../src/jit.h"
 #include "../src/literal.h"
+#include "../src/memo.h"
+#include "../src/optimizer.h"
+#include "../src/par.h"
+#include "../src/parser.h"
+#include "../src/resolver.h"
+#include "../src/scratch.h"
+#include "../src/symbol.h"
+#include "../src/typechecker.h"
+#include "../src/value.h"
+#include "../src/vm.h"
 
 #define TEST(test_fn) test_fn(); printf("\033[32mpassed: "); printf(#test_fn); printf("\033[0m\n");
 
@@ -9,14 +26,138 @@ void escape_testsuite() {
     TEST(test_unescape)
 }
 
+void gc_testsuite() {
+    TEST(test_gc_frees_garbage)
+    TEST(test_gc_keeps_roots)
+    TEST(test_gc_bounds_memory)
+}
+
 void literal_testsuite() {
     TEST(test_match_int_literal)
     TEST(test_match_float_literal)
     TEST(test_match_bool_literal)
 }
 
+void parser_testsuite() {
+    TEST(test_parse_forms)
+}
+
+void symbol_testsuite() {
+    TEST(test_intern)
+}
+
+void hamt_testsuite() {
+    TEST(test_hamt_persistent)
+    TEST(test_hamt_collisions)
+}
+
+void value_testsuite() {
+    TEST(test_int_vals)
+    TEST(test_float_vals)
+    TEST(test_val_kinds)
+}
+
+void bigint_testsuite() {
+    TEST(test_bigint_promotes)
+    TEST(test_bigint_karatsuba)
+    TEST(test_bigint_div)
+}
+
+void resolver_testsuite() {
+    TEST(test_resolve_locals)
+    TEST(test_resolve_globals)
+    TEST(test_resolve_captures)
+}
+
+void typechecker_testsuite() {
+    TEST(test_typecheck_infers)
+    TEST(test_typecheck_generalizes)
+    TEST(test_typecheck_marks_int_args)
+}
+
+void scratch_testsuite() {
+    TEST(test_scratch_let_tuples)
+    TEST(test_scratch_escaping_tuples)
+}
+
+void compiler_testsuite() {
+    TEST(test_compile_call)
+    TEST(test_compile_if)
+    TEST(test_compile_binary_ops)
+}
+
+void optimizer_testsuite() {
+    TEST(test_fold_arithmetic)
+    TEST(test_fold_propagates_lets)
+    TEST(test_fold_prunes_ifs)
+    TEST(test_fold_respects_rebinding)
+    TEST(test_inline_small_fns)
+    TEST(test_inline_keeps_effects)
+}
+
+void vm_testsuite() {
+    TEST(test_vm_arithmetic)
+    TEST(test_vm_binary_ops)
+    TEST(test_vm_recursion)
+    TEST(test_vm_chain)
+    TEST(test_vm_tail_calls)
+    TEST(test_vm_closures)
+    TEST(test_vm_scratch_tuples)
+    TEST(test_vm_stack_overflow)
+}
+
+void par_testsuite() {
+    TEST(test_par_results)
+    TEST(test_par_nested)
+    TEST(test_par_collects)
+    TEST(test_par_bulk)
+    TEST(test_par_reduce_deterministic)
+}
+
+void async_testsuite() {
+    TEST(test_async_spawn_await)
+    TEST(test_async_suspends)
+    TEST(test_async_await_blocks)
+    TEST(test_async_collects)
+}
+
+void memo_testsuite() {
+    TEST(test_memo_get_set)
+    TEST(test_memo_evicts)
+    TEST(test_memo_fns)
+}
+
+void jit_testsuite() {
+    TEST(test_jit_compiles_hot_fns)
+    TEST(test_jit_falls_back)
+    TEST(test_jit_deep_recursion)
+}
+
+void aot_testsuite() {
+    TEST(test_aot_call)
+    TEST(test_emit_c)
+}
 
 int main() {
     TEST(escape_testsuite)
     TEST(literal_testsuite)
+    TEST(parser_testsuite)
+    TEST(symbol_testsuite)
+    TEST(hamt_testsuite)
+    TEST(value_testsuite)
+    TEST(bigint_testsuite)
+    TEST(resolver_testsuite)
+    TEST(typechecker_testsuite)
+    TEST(scratch_testsuite)
+    TEST(optimizer_testsuite)
+    TEST(compiler_testsuite)
+    TEST(vm_testsuite)
+    TEST(par_testsuite)
+    TEST(async_testsuite)
+    TEST(gc_testsuite)
+    TEST(memo_testsuite)
+#ifdef JIT_SUPPORTED
+    TEST(jit_testsuite)
+#endif
+    TEST(aot_testsuite)
 }
\ No newline at end of file